@@ -6,6 +6,8 @@
 #include "../dialogs/connectionsettingsdialog.h"
 #include "../network/downloaditem.h"
 #include "../network/downloadmanager.h"
+#include "../network/metalink.h"
+#include "../network/streamsession.h"
 #include "../dialogs/youtubedownloaddialog.h"
 
 #define MAX_CONCURRENT_DOWNLOADS 6 // this sets the max concurrent downloads
@@ -29,8 +31,53 @@
 #include <QApplication>
 #include <QRegularExpression>
 #include <QClipboard>
+#include <QRandomGenerator>
+#include <QMetaEnum>
 #include "../utils/utils.h"
 
+namespace {
+constexpr qsizetype kMaxRequestHeader = 16 * 1024; // Local server: headers larger than this are dropped
+
+// Items queued once live on a network worker thread and must be deleted there
+void disposeItems(QList<DownloadItem*> &items)
+{
+    for (DownloadItem *item : items) {
+        if (item->thread() == QThread::currentThread()) delete item;
+        else item->deleteLater();
+    }
+    items.clear();
+}
+
+// Transports are kept in settings and history by their enum names
+QString transportName(DownloadItem::Transport transport)
+{
+    return QString::fromLatin1(QMetaEnum::fromType<DownloadItem::Transport>().valueToKey(transport));
+}
+
+DownloadItem::Transport transportFromName(const QString &name, DownloadItem::Transport fallback)
+{
+    bool ok = false;
+    const int value = QMetaEnum::fromType<DownloadItem::Transport>().keyToValue(name.toLatin1().constData(), &ok);
+    return ok ? DownloadItem::Transport(value) : fallback;
+}
+
+// A checksum as typed by the user: a digest ("sha256:<hex>" or bare hex) or
+// the URL of a .sha256 / .sha1 / .md5 file. Empty text means none.
+bool applyChecksum(DownloadItem *item, const QString &text)
+{
+    if (text.isEmpty()) return true;
+    const QUrl url(text);
+    if (url.scheme() == "http" || url.scheme() == "https") {
+        item->setChecksumUrl(url);
+        return true;
+    }
+    const Checksum checksum = Checksum::fromString(text);
+    if (!checksum.isValid()) return false;
+    item->setExpectedChecksum(checksum);
+    return true;
+}
+}
+
 bool speedLimitEnabled = false;
 int currentSpeedLimit = 0;
 
@@ -88,6 +135,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     connect(ui->actionSettings, &QAction::triggered, this, [this]() { openSpeedLimiterDialog(); });
     connect(ui->actionPreferences, &QAction::triggered, this, &MainWindow::openPreferences);
     connect(m_downloadManager, &DownloadManager::queueStatusChanged, this, &MainWindow::onQueueStatusChanged);
+    connect(m_downloadManager, &DownloadManager::itemHeld, this, [this](DownloadItem *item, const QString &reason) {
+        ui->statusBar->showMessage(item->getFileName() + ": " + reason);
+    });
 
     contextMenu = new QMenu(this);
     contextMenu->setStyleSheet(
@@ -102,9 +152,11 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     updatelink = new QAction("Update Link",this);
     retryAction = new QAction("Retry", this);
     openFileAction = new QAction("Open File", this);
+    streamAction = new QAction("Play While Downloading", this);
     openfilelocation = new QAction("Open File Location", this);
     deleteAction = new QAction("Delete", this);
     copyUrlAction = new QAction("Copy URL", this);
+    hostLimitAction = new QAction("Limit Speed for This Host...", this);
     youtubeAction = new QAction("Download from YouTube", this);
     detailsAction = new QAction("View Details", this);
 
@@ -115,10 +167,22 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     contextMenu->addAction(updatelink);
     contextMenu->addAction(retryAction);
     contextMenu->addAction(openFileAction);
+    contextMenu->addAction(streamAction);
     contextMenu->addAction(openfilelocation);
     contextMenu->addAction(deleteAction);
     contextMenu->addSeparator();
     contextMenu->addAction(copyUrlAction);
+    contextMenu->addAction(hostLimitAction);
+    transportMenu = contextMenu->addMenu("Transport");
+    transportGroup = new QActionGroup(this);
+    const QList<QPair<QString, int>> transports = {
+        {"Default", -1}, {"Qt Network", DownloadItem::QtNetwork}, {"Native HTTP/1.1", DownloadItem::NativeHttp}, {"HTTP/2", DownloadItem::Http2}};
+    for (const auto &transport : transports) {
+        QAction *action = transportMenu->addAction(transport.first);
+        action->setCheckable(true);
+        action->setData(transport.second);
+        transportGroup->addAction(action);
+    }
     contextMenu->addAction(youtubeAction);
     contextMenu->addAction(detailsAction);
 
@@ -171,6 +235,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
             if (item) openFile(item);
         }
     });
+    connect(streamAction, &QAction::triggered, this, [this]() {
+        int row = ui->downloadsTable->currentRow();
+        if (row >= 0) {
+            DownloadItem *item = getDownloadItemForRow(row);
+            if (item) streamDownload(item);
+        }
+    });
     connect(deleteAction, &QAction::triggered, this, [this]() {
         int row = ui->downloadsTable->currentRow();
         if (row >= 0) {
@@ -185,6 +256,22 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
             if (item) copyUrl(item);
         }
     });
+    connect(transportGroup, &QActionGroup::triggered, this, [this](QAction *action) {
+        int row = ui->downloadsTable->currentRow();
+        DownloadItem *item = row >= 0 ? getDownloadItemForRow(row) : nullptr;
+        if (!item) return;
+        // Taken up the next time the item starts
+        const int choice = action->data().toInt();
+        if (choice < 0) item->setTransport(m_downloadManager->defaultTransport(), false);
+        else item->setTransport(DownloadItem::Transport(choice));
+    });
+    connect(hostLimitAction, &QAction::triggered, this, [this]() {
+        int row = ui->downloadsTable->currentRow();
+        if (row >= 0) {
+            DownloadItem *item = getDownloadItemForRow(row);
+            if (item) limitHostSpeed(item);
+        }
+    });
     connect(youtubeAction, &QAction::triggered, this, &MainWindow::downloadFromYouTube);
 
     ui->downloadsTable->setContextMenuPolicy(Qt::CustomContextMenu);
@@ -234,7 +321,22 @@ void MainWindow::readClient()
         return;
     }
 
-    QByteArray data = socket->readAll();
+    // A request can arrive in several reads: keep what came until its headers end
+    QByteArray data = socket->property("pendingRequest").toByteArray() + socket->readAll();
+    if (!data.contains("\r\n\r\n")) {
+        if (data.size() > kMaxRequestHeader) {
+            qWarning() << "Dropping a local request with over" << kMaxRequestHeader << "bytes of headers";
+            socket->abort();
+            return;
+        }
+        socket->setProperty("pendingRequest", data);
+        return;
+    }
+    socket->setProperty("pendingRequest", QVariant());
+    if (data.startsWith("GET /stream/") || data.startsWith("HEAD /stream/")) {
+        serveStream(socket, data);
+        return;
+    }
     QString request(data);
     qDebug() << "Received data at" << QDateTime::currentDateTime().toString() << ":" << request;
 
@@ -296,7 +398,7 @@ void MainWindow::readClient()
                 QString fileName = m_confirmationDialog->getCustomFileName().isEmpty() ? QFileInfo(url.path()).fileName() : m_confirmationDialog->getCustomFileName();
                 bool showYouTubeDialog = m_confirmationDialog->shouldShowYouTubeDialog() && isYouTube;
                 qDebug() << "Starting download for URL:" << url.toString() << "with category:" << category << "and fileName:" << fileName;
-                addDownload(url, "", category, fileName, showYouTubeDialog);
+                addDownload(url, "", category, fileName, showYouTubeDialog, m_confirmationDialog->getChecksum());
                 socket->write("HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n\r\nDownload started");
             } else if (method == "HEAD") {
                 socket->write("HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n\r\nHEAD request acknowledged");
@@ -318,6 +420,33 @@ void MainWindow::readClient()
     socket->flush();
     socket->disconnectFromHost();
 }
+/**
+ * @brief GET/HEAD /stream/<token>/<file name>: the download's file as far as it
+ * goes, with Range support, for a player to read while it downloads. Only URLs
+ * handed out by streamDownload() carry the token.
+ */
+void MainWindow::serveStream(QTcpSocket *socket, const QByteArray &request)
+{
+    disconnect(socket, &QTcpSocket::readyRead, this, &MainWindow::readClient);
+    const qsizetype start = request.indexOf("/stream/") + 8;
+    QByteArray path = request.mid(start, request.indexOf(' ', start) - start);
+    if (path.contains('?')) path.truncate(path.indexOf('?'));
+    const qsizetype slash = path.indexOf('/');
+    const bool tokenOk = slash > 0 && !m_streamToken.isEmpty() && path.left(slash) == m_streamToken;
+    const QString fileName = QUrl::fromPercentEncoding(path.mid(slash + 1));
+
+    for (const QList<DownloadItem*> &list : std::as_const(categories)) {
+        for (DownloadItem *item : list) {
+            if (tokenOk && item && item->getFileName() == fileName) {
+                new StreamSession(socket, item, request, this); // Deletes itself when done
+                return;
+            }
+        }
+    }
+    socket->write("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nNo such download");
+    socket->disconnectFromHost();
+}
+
 MainWindow::~MainWindow()
 {
     saveDownloadHistory();
@@ -325,8 +454,7 @@ MainWindow::~MainWindow()
         m_downloadManager->stopAll();
     }
     for (auto &list : categories) {
-        qDeleteAll(list);
-        list.clear();
+        disposeItems(list);
     }
     delete ui;
     delete aboutDialog;
@@ -338,6 +466,7 @@ MainWindow::~MainWindow()
     delete openFileAction;
     delete deleteAction;
     delete copyUrlAction;
+    delete hostLimitAction;
     delete m_detailsDialog;
     delete youtubeAction;
 }
@@ -444,7 +573,8 @@ void MainWindow::showContextMenu(const QPoint &pos)
         }
     }
 }
-void MainWindow::addDownload(const QUrl &url, const QString &path, const QString &category, const QString &customFileName, bool showYouTubeDialog)
+void MainWindow::addDownload(const QUrl &url, const QString &path, const QString &category, const QString &customFileName, bool showYouTubeDialog,
+                             const QString &checksum, const QList<QUrl> &mirrors)
 {
     if (!url.isValid()) {
         QMessageBox::warning(this, tr("Invalid URL"), tr("The entered URL is not valid."));
@@ -475,7 +605,14 @@ void MainWindow::addDownload(const QUrl &url, const QString &path, const QString
         if (reply == QMessageBox::No) return;
     }
 
-    auto *item = new DownloadItem(url, fullPath, this);
+    auto *item = new DownloadItem(url, fullPath);
+    applyWriteMode(item);
+    if (!applyChecksum(item, checksum)) {
+        delete item;
+        QMessageBox::warning(this, tr("Invalid Checksum"), tr("Expected a checksum like sha256:<hex> or the URL of a checksum file."));
+        return;
+    }
+    item->setMirrors(mirrors);
     item->setNumChunks(8);
     item->setState(DownloadItem::Queued);
     item->setLastTryDate(QDateTime::currentDateTime());
@@ -490,6 +627,7 @@ void MainWindow::addDownload(const QUrl &url, const QString &path, const QString
     connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
     connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
     connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+    connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
     if (isYouTubeUrl(url.toString())) {
         if (showYouTubeDialog) {
@@ -528,8 +666,15 @@ void MainWindow::updateContextMenuActions(DownloadItem *item)
     stopAction->setEnabled(state != DownloadItem::Completed && state != DownloadItem::Failed);
     retryAction->setEnabled(state == DownloadItem::Failed || state == DownloadItem::Stopped);
     openFileAction->setEnabled(state == DownloadItem::Completed);
+    streamAction->setEnabled(state != DownloadItem::Completed);
     deleteAction->setEnabled(state != DownloadItem::Downloading);
     copyUrlAction->setEnabled(true);
+    hostLimitAction->setEnabled(!item->getUrl().host().isEmpty());
+    transportMenu->setEnabled(state != DownloadItem::Downloading && state != DownloadItem::Completed);
+    for (QAction *action : transportGroup->actions()) {
+        const int choice = action->data().toInt();
+        action->setChecked(item->isTransportChosen() ? choice == item->getTransport() : choice < 0);
+    }
 }
 
 void MainWindow::retryDownload(DownloadItem *item)
@@ -548,6 +693,34 @@ void MainWindow::openFile(DownloadItem *item)
     }
 }
 
+/**
+ * @brief Switches the item to sequential order and opens its stream from the
+ * local server in the default player, to watch it while it downloads.
+ */
+void MainWindow::streamDownload(DownloadItem *item)
+{
+    if (!item) return;
+    if (!m_server->isListening()) {
+        QMessageBox::warning(this, "Play While Downloading", "The local server is not running.");
+        return;
+    }
+    if (m_streamToken.isEmpty()) {
+        QByteArray random(16, Qt::Uninitialized);
+        QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(random.data()), random.size() / int(sizeof(quint32)));
+        m_streamToken = random.toHex();
+    }
+    item->setSequential(true);
+    if (item->getState() == DownloadItem::Paused) resumeDownload(item);
+    else if (item->getState() == DownloadItem::Failed || item->getState() == DownloadItem::Stopped) retryDownload(item);
+
+    QUrl url;
+    url.setScheme("http");
+    url.setHost("127.0.0.1");
+    url.setPort(m_server->serverPort());
+    url.setPath("/stream/" + QString::fromLatin1(m_streamToken) + "/" + item->getFileName());
+    QDesktopServices::openUrl(url);
+}
+
 void MainWindow::deleteDownload(DownloadItem *item)
 {
     if (!item || item->getState() == DownloadItem::Downloading) return;
@@ -561,6 +734,7 @@ void MainWindow::deleteDownload(DownloadItem *item)
             ui->downloadsTable->removeRow(row);
             itemRowMap.remove(item);
         }
+        mergePercent.remove(item);
 
         for (auto &list : categories) {
             list.removeOne(item);
@@ -571,13 +745,14 @@ void MainWindow::deleteDownload(DownloadItem *item)
             QFile::remove(filePath);
         }
         if (!item->isSingleChunk()) {
-            for (int chunk = 0; chunk < item->getNumChunks(); ++chunk) {
-                QString chunkFileName = QString("%1.chunk%2").arg(filePath).arg(chunk);
+            for (int chunk = 0; chunk < qMax(item->getNumChunks(), item->getSegmentCount()); ++chunk) {
+                QString chunkFileName = item->chunkFilePath(chunk);
                 if (QFile::exists(chunkFileName)) {
                     QFile::remove(chunkFileName);
                 }
             }
         }
+        QFile::remove(item->getManifestPath());
 
         item->deleteLater();
         scheduleTableUpdate();
@@ -594,16 +769,58 @@ void MainWindow::copyUrl(DownloadItem *item)
     }
 }
 
+/**
+ * @brief New downloads are written per the chunk-file settings; items from the
+ * history keep the mode they started with.
+ */
+void MainWindow::applyWriteMode(DownloadItem *item)
+{
+    item->setWriteMode(chunkFiles ? DownloadItem::ChunkFiles : DownloadItem::DirectWrite);
+    item->setChunkDirectory(chunkFiles ? chunkDirectory : QString());
+}
+
+/**
+ * @brief Caps what all downloads from the item's host may take together, in
+ * KB/s; 0 lifts the cap. Kept across sessions.
+ */
+void MainWindow::limitHostSpeed(DownloadItem *item)
+{
+    const QString host = item ? item->getUrl().host().toLower() : QString();
+    if (host.isEmpty()) return;
+    bool ok = false;
+    const int kbps = QInputDialog::getInt(this, "Limit Host Speed", "Speed limit for " + host + " in KB/s (0 for none):",
+                                          hostSpeedLimits.value(host, 0).toInt(), 0, 1024 * 1024, 1, &ok);
+    if (!ok) return;
+    if (kbps > 0) hostSpeedLimits.insert(host, kbps);
+    else hostSpeedLimits.remove(host);
+    m_downloadManager->setHostSpeedLimit(host, qint64(kbps) * 1024);
+    savePreferences();
+}
+
 void MainWindow::newDownload()
 {
-    QString urlStr = QInputDialog::getText(this, "New Download", "Enter URL:");
-    if (urlStr.isEmpty()) return;
+    QString input = QInputDialog::getText(this, "New Download", "Enter URL or Metalink (optionally followed by mirror URLs and sha256:<hex> or a checksum file URL):");
+    QStringList parts = input.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    if (parts.isEmpty()) return;
 
-    QUrl url(urlStr);
+    QUrl url(parts.takeFirst());
     if (!url.isValid()) {
         QMessageBox::warning(this, "Invalid URL", "Please enter a valid URL.");
         return;
     }
+    if (Metalink::isMetalink(url)) {
+        addMetalink(url);
+        return;
+    }
+
+    // Further URLs are mirrors, unless they name a checksum file
+    QList<QUrl> mirrors;
+    QString checksum;
+    for (const QString &part : std::as_const(parts)) {
+        const QUrl extra(part);
+        if ((extra.scheme() == "http" || extra.scheme() == "https") && Checksum::algorithmForUrl(extra) == Checksum::None) mirrors.append(extra);
+        else checksum = part;
+    }
 
     QString fileName = QFileInfo(url.path()).fileName();
     if (fileName.isEmpty()) {
@@ -618,7 +835,49 @@ void MainWindow::newDownload()
         if (reply == QMessageBox::No) return;
     }
 
-    addDownload(url, savePath);
+    addDownload(url, savePath, checksum, mirrors);
+}
+
+/**
+ * @brief Adds every file of a Metalink document, local or remote, with its
+ * mirrors and checksum.
+ */
+void MainWindow::addMetalink(const QUrl &url)
+{
+    if (url.isLocalFile() || url.scheme().isEmpty()) {
+        QFile file(url.isLocalFile() ? url.toLocalFile() : url.toString());
+        if (!file.open(QIODevice::ReadOnly)) {
+            QMessageBox::warning(this, tr("Metalink"), tr("Cannot read %1").arg(file.fileName()));
+            return;
+        }
+        addMetalinkFiles(file.readAll());
+        return;
+    }
+
+    QNetworkReply *reply = networkManager->get(QNetworkRequest(url));
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) {
+            QMessageBox::warning(this, tr("Metalink"), tr("Cannot fetch %1: %2").arg(reply->url().toString(), reply->errorString()));
+            return;
+        }
+        addMetalinkFiles(reply->readAll());
+    });
+}
+
+void MainWindow::addMetalinkFiles(const QByteArray &xml)
+{
+    Metalink metalink;
+    if (!metalink.parse(xml)) {
+        QMessageBox::warning(this, tr("Metalink"), tr("Not a usable Metalink file: %1").arg(metalink.errorString()));
+        return;
+    }
+    for (const Metalink::File &file : metalink.files()) {
+        QList<QUrl> mirrors = file.urls;
+        const QUrl url = mirrors.takeFirst();
+        qDebug() << "Metalink file" << file.name << "with" << mirrors.size() << "mirrors and" << file.checksum.toString();
+        addDownload(url, "", "", file.name, false, file.checksum.toString(), mirrors);
+    }
 }
 
 void MainWindow::onNetworkReachabilityChanged(QNetworkInformation::Reachability reachability)
@@ -640,7 +899,7 @@ void MainWindow::onNetworkReachabilityChanged(QNetworkInformation::Reachability
     }
 }
 
-void MainWindow::addDownload(const QUrl &url, const QString &path)
+void MainWindow::addDownload(const QUrl &url, const QString &path, const QString &checksum, const QList<QUrl> &mirrors)
 {
     if (!url.isValid()) {
         QMessageBox::warning(this, tr("Invalid URL"), tr("The entered URL is not valid."));
@@ -662,7 +921,7 @@ void MainWindow::addDownload(const QUrl &url, const QString &path)
             QString filePath = dialog.getOutputPath();
             if (!filePath.isEmpty()) {
                 QString fileName = dialog.getYtdlArgs().contains("--extract-audio") ? "audio.mp3" : "video.mp4";
-                auto *item = new DownloadItem(url, filePath + "/" + fileName, this);
+                auto *item = new DownloadItem(url, filePath + "/" + fileName);
                 item->setNumChunks(8);
                 item->setState(DownloadItem::Queued);
                 item->setLastTryDate(QDateTime::currentDateTime());
@@ -674,12 +933,20 @@ void MainWindow::addDownload(const QUrl &url, const QString &path)
                 connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
                 connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
                 connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+                connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
                 m_downloadManager->downloadYouTubeWithOptions(item, dialog.getYtdlArgs());
             }
         }
     } else {
-        auto *item = new DownloadItem(url, downloadPath + "/" + (url.fileName().isEmpty() ? "download" : url.fileName()), this);
+        auto *item = new DownloadItem(url, downloadPath + "/" + (url.fileName().isEmpty() ? "download" : url.fileName()));
+        applyWriteMode(item);
+        if (!applyChecksum(item, checksum)) {
+            delete item;
+            QMessageBox::warning(this, tr("Invalid Checksum"), tr("Expected a checksum like sha256:<hex> or the URL of a checksum file."));
+            return;
+        }
+        item->setMirrors(mirrors);
         item->setNumChunks(8);
         item->setState(DownloadItem::Queued);
         item->setLastTryDate(QDateTime::currentDateTime());
@@ -691,6 +958,7 @@ void MainWindow::addDownload(const QUrl &url, const QString &path)
         connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
         connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
         connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+        connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
         m_downloadManager->addToQueue(item);
     }
@@ -715,8 +983,7 @@ void MainWindow::pauseDownload(DownloadItem *item)
 void MainWindow::resumeDownload(DownloadItem *item)
 {
     if (item && item->getState() == DownloadItem::Paused) {
-        item->resume();
-        m_downloadManager->addToQueue(item);
+        m_downloadManager->resumeItem(item);
         scheduleTableUpdate();
     }
 }
@@ -730,10 +997,18 @@ void MainWindow::stopDownload(DownloadItem *item)
 }
 
 void MainWindow::handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    Q_UNUSED(bytesReceived);
+    Q_UNUSED(bytesTotal);
+    // Items publish at a bounded rate; the table reads their snapshots on its own timer
+    scheduleTableUpdate();
+}
+
+void MainWindow::handleMergeProgress(qint64 bytesMerged, qint64 bytesTotal)
 {
     DownloadItem *item = qobject_cast<DownloadItem*>(sender());
-    if (!item) return;
-    qDebug() << "Progress signal received for" << item->getFileName() << ":" << bytesReceived << "/" << bytesTotal;
+    if (!item || bytesTotal <= 0) return;
+    mergePercent[item] = int(bytesMerged * 100 / bytesTotal);
     scheduleTableUpdate();
 }
 
@@ -749,12 +1024,14 @@ void MainWindow::handleDownloadFinished()
     DownloadItem *item = qobject_cast<DownloadItem*>(sender());
     if (!item) return;
     qDebug() << "Finished signal received for" << item->getFileName();
+    mergePercent.remove(item);
     scheduleTableUpdate();
 }
 
 void MainWindow::handleDownloadFailed(const QString &reason)
 {
     qDebug() << "Handling download failure:" << reason;
+    mergePercent.remove(qobject_cast<DownloadItem*>(sender()));
 
     if (!reason.contains("paused by user", Qt::CaseInsensitive)) {
         QMessageBox::warning(this, "Download Failed", reason);
@@ -823,8 +1100,8 @@ void MainWindow::clearCompletedDownloads()
                 }
 
                 if (!item->isSingleChunk()) {
-                    for (int chunk = 0; chunk < item->getNumChunks(); ++chunk) {
-                        QString chunkFileName = QString("%1.chunk%2").arg(filePath).arg(chunk);
+                    for (int chunk = 0; chunk < qMax(item->getNumChunks(), item->getSegmentCount()); ++chunk) {
+                        QString chunkFileName = item->chunkFilePath(chunk);
                         if (QFile::exists(chunkFileName)) {
                             if (!QFile::remove(chunkFileName)) {
                                 qWarning() << "Failed to remove chunk file:" << chunkFileName;
@@ -832,6 +1109,7 @@ void MainWindow::clearCompletedDownloads()
                         }
                     }
                 }
+                QFile::remove(item->getManifestPath());
 
                 item->deleteLater();
                 qDebug() << "Item" << fileName << "and its files have been removed.";
@@ -864,18 +1142,6 @@ void MainWindow::openSpeedLimiterDialog()
             qWarning() << "DownloadManager is null, cannot apply speed limit";
         }
 
-        QMutexLocker locker(&mutex);
-        for (auto& list : categories) {
-            for (DownloadItem* item : list) {
-                if (item) {
-                    qDebug() << "Setting speed limit for" << item->getFileName() << "to" << limit;
-                    item->setSpeedLimit(limit);
-                } else {
-                    qWarning() << "Null item in categories list";
-                }
-            }
-        }
-
         ui->actionOn->setChecked(speedLimitEnabled);
         scheduleTableUpdate();
     }
@@ -892,16 +1158,6 @@ void MainWindow::toggleSpeedLimiter(bool enabled) {
         qWarning() << "toggleSpeedLimiter: DownloadManager is null";
         return;
     }
-    QMutexLocker locker(&mutex);
-    for (auto& list : categories) {
-        for (DownloadItem* item : list) {
-            if (item) {
-                item->setSpeedLimit(limit);
-            } else {
-                qWarning() << "toggleSpeedLimiter: Null item";
-            }
-        }
-    }
     ui->actionOn->setChecked(enabled);
     ui->actionOff->setChecked(!enabled);
     scheduleTableUpdate();
@@ -987,14 +1243,12 @@ void MainWindow::refreshLinkForSelectedItem()
 
 void MainWindow::scheduleTableUpdate()
 {
-    qDebug() << "Scheduling table update";
     if (!updateTimer->isActive()) {
         updateTimer->start();
     }
 }
 
 void MainWindow::updateDownloadTable() {
-    qDebug() << "Updating download table, rows:" << ui->downloadsTable->rowCount();
     QList<DownloadItem*> allDownloads;
     for (auto &list : categories) {
         for (DownloadItem* item : list) {
@@ -1027,21 +1281,25 @@ void MainWindow::updateDownloadTable() {
                 fileName = "unnamed_file_" + QString::number(row);
                 qDebug() << "Invalid filename, replaced with" << fileName;
             }
-            qint64 totalSize = item->getTotalSize();
+            const DownloadItem::ProgressSnapshot snapshot = item->getProgressSnapshot();
+            qint64 totalSize = snapshot.total;
             if (totalSize < 0) totalSize = 0;
-            qint64 downloadedSize = item->getDownloadedSize();
+            qint64 downloadedSize = snapshot.downloaded;
             if (downloadedSize < 0) downloadedSize = 0;
-            QString status = [item]() {
-                switch (item->getState()) {
+            QString status = [item, &snapshot]() {
+                switch (snapshot.state) {
                 case DownloadItem::Queued: return "Queued";
                 case DownloadItem::Downloading: return "Downloading";
                 case DownloadItem::Paused: return "Paused";
                 case DownloadItem::Stopped: return "Stopped";
-                case DownloadItem::Completed: return "Completed";
-                case DownloadItem::Failed: return "Failed";
+                case DownloadItem::Completed: return item->getIntegrity() == DownloadItem::Verified ? "Completed (verified)" : "Completed";
+                case DownloadItem::Failed: return item->getIntegrity() == DownloadItem::Corrupt ? "Failed (corrupt)" : "Failed";
                 default: return "Unknown";
                 }
             }();
+            // Chunk-file downloads are joined into the target once every chunk is in
+            const int merged = mergePercent.value(item, -1);
+            if (snapshot.state == DownloadItem::Downloading && merged >= 0) status = QString("Merging %1%").arg(merged);
             int queuePosition = -1;
             if (m_downloadManager && m_downloadManager->isItemActive(item)) {
                 queuePosition = 0;
@@ -1049,7 +1307,13 @@ void MainWindow::updateDownloadTable() {
                 int posInQueue = m_downloadManager->getQueuePosition(item);
                 queuePosition = (posInQueue >= 0) ? posInQueue + 1 : -1;
             }
-            qint64 transferRate = item->getTransferRate();
+            qint64 transferRate = snapshot.rate;
+            // The item's estimate follows the last few seconds, not the smoothed rate
+            const auto timeLeftText = [&]() -> QString {
+                if (status != "Downloading" || totalSize <= 0) return "-";
+                if (snapshot.secondsLeft >= 0) return formatTimeLeft(snapshot.secondsLeft);
+                return transferRate > 0 ? formatTimeLeft((totalSize - downloadedSize) / transferRate) : "-";
+            };
             if (transferRate < 0) transferRate = 0;
             QDateTime lastTryDate = item->getLastTryDate();
             QString description = item->getDescription();
@@ -1060,16 +1324,11 @@ void MainWindow::updateDownloadTable() {
                                   ui->downloadsTable->item(row, 2)->text() != status ||
                                   ui->downloadsTable->item(row, 3)->text() != (queuePosition >= 0 ? QString::number(queuePosition) : "-") ||
                                   ui->downloadsTable->item(row, 5)->text() != (transferRate > 0 ? QString("%1/s").arg(formatSize(transferRate).remove(QRegularExpression("\\s*[A-Z]+"))) : "-") ||
-                                  ui->downloadsTable->item(row, 4)->text() != (status == "Downloading" && transferRate > 0 && totalSize > 0 ? formatTimeLeft((totalSize - downloadedSize) / (transferRate > 0 ? transferRate : 1)) : "-");
+                                  ui->downloadsTable->item(row, 4)->text() != timeLeftText();
             if (rowNeedsUpdate) {
                 updated = true;
                 QString sizeText = formatSize(totalSize);
-                QString timeLeft = "-";
-                if (status == "Downloading" && transferRate > 0 && totalSize > 0) {
-                    qint64 remaining = totalSize - downloadedSize;
-                    qint64 secondsLeft = remaining / (transferRate > 0 ? transferRate : 1);
-                    timeLeft = formatTimeLeft(secondsLeft);
-                }
+                QString timeLeft = timeLeftText();
                 QString rateText = transferRate > 0 ? QString("%1/s").arg(formatSize(transferRate).remove(QRegularExpression("\\s*[A-Z]+"))) : "-";
                 QTableWidgetItem* itemCell = new QTableWidgetItem(fileName);
                 itemCell->setData(Qt::UserRole, QVariant::fromValue(item));
@@ -1183,8 +1442,7 @@ void MainWindow::loadDownloadListFromFile(const QString &filename)
 
     QJsonArray jsonArray = doc.array();
     for (auto &list : categories) {
-        qDeleteAll(list);
-        list.clear();
+        disposeItems(list);
     }
 
     for (const QJsonValue &val : jsonArray) {
@@ -1195,7 +1453,8 @@ void MainWindow::loadDownloadListFromFile(const QString &filename)
         QString fileName = obj["fileName"].toString();
         QString path = QStandardPaths::writableLocation(QStandardPaths::DownloadLocation) + "/" + fileName;
 
-        DownloadItem *item = new DownloadItem(url, path, this);
+        DownloadItem *item = new DownloadItem(url, path);
+        applyWriteMode(item);
         item->setFileName(fileName);
         item->setTotalSize(obj["totalSize"].toString().toLongLong());
         item->setDownloadedSize(obj["downloadedSize"].toString().toLongLong());
@@ -1215,6 +1474,7 @@ void MainWindow::loadDownloadListFromFile(const QString &filename)
         connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
         connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
         connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+        connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
         if (item->getState() != DownloadItem::Completed && item->getState() != DownloadItem::Paused) {
             m_downloadManager->addToQueue(item);
@@ -1250,6 +1510,15 @@ void MainWindow::saveDownloadHistory()
             itemObj["description"] = item->getDescription();
             itemObj["paused"] = (item->getState() == DownloadItem::Paused);
             itemObj["numChunks"] = item->getNumChunks(); // Add numChunks to save
+            itemObj["checksum"] = item->getExpectedChecksum().toString();
+            QJsonArray mirrors;
+            for (const QUrl &mirror : item->getMirrors()) mirrors.append(mirror.toString());
+            itemObj["mirrors"] = mirrors;
+            if (item->isTransportChosen()) itemObj["transport"] = transportName(item->getTransport());
+            if (item->getWriteMode() == DownloadItem::ChunkFiles) {
+                itemObj["chunkFiles"] = true;
+                itemObj["chunkDirectory"] = item->getChunkDirectory();
+            }
             jsonArray.append(itemObj);
         }
     }
@@ -1327,7 +1596,7 @@ void MainWindow::loadDownloadHistory()
             continue;
         }
 
-        auto *item = new DownloadItem(url, filePath, this);
+        auto *item = new DownloadItem(url, filePath);
         if (!item) {
             qWarning() << "loadDownloadHistory: Failed to create DownloadItem for URL:" << url.toString()
             << "at" << QDateTime::currentDateTime().toString("hh:mm:ss");
@@ -1347,33 +1616,21 @@ void MainWindow::loadDownloadHistory()
         item->setDescription(itemObj["description"].toString());
         int numChunks = itemObj.contains("numChunks") ? itemObj["numChunks"].toInt(8) : 8;
         item->setNumChunks(numChunks);
-
-        // Safely handle chunk progress only for initialized items
-        qint64 expectedTotal = item->getTotalSize();
-        qint64 sumChunks = 0;
-        if (numChunks == 1) {
-            sumChunks = item->getDownloadedSize(); // Single-chunk fallback
-        } else if (numChunks > 1) {
-            // Only check if getChunkProgress is implemented and safe
-            qint64 chunkProgress = item->getChunkProgress(0); // Test first chunk
-            if (chunkProgress >= 0) {
-                sumChunks += chunkProgress;
-                qDebug() << "loadDownloadHistory: Chunk 0 progress:" << chunkProgress << "for" << item->getFileName();
-            } else {
-                qWarning() << "loadDownloadHistory: Invalid chunk progress for" << item->getFileName();
-            }
+        item->setExpectedChecksum(Checksum::fromString(itemObj["checksum"].toString()));
+        QList<QUrl> mirrors;
+        for (const QJsonValue &mirror : itemObj["mirrors"].toArray()) mirrors.append(QUrl(mirror.toString()));
+        item->setMirrors(mirrors);
+        if (itemObj.contains("transport")) item->setTransport(transportFromName(itemObj["transport"].toString(), defaultTransport));
+        if (itemObj["chunkFiles"].toBool()) { // Kept as it started: its chunk files are where it left them
+            item->setWriteMode(DownloadItem::ChunkFiles);
+            item->setChunkDirectory(itemObj["chunkDirectory"].toString());
         }
-        qDebug() << "loadDownloadHistory: Loaded" << item->getFileName()
-                 << ", numChunks:" << numChunks
-                 << ", downloadedSize:" << item->getDownloadedSize()
-                 << ", sumChunks:" << sumChunks
-                 << ", totalSize:" << expectedTotal
-                 << "at" << QDateTime::currentDateTime().toString("hh:mm:ss");
 
         connect(item, &DownloadItem::progress, this, &MainWindow::handleDownloadProgress, Qt::QueuedConnection);
         connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
         connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
         connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+        connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
         if (!categories.contains("All Downloads")) {
             categories["All Downloads"] = QList<DownloadItem*>();
@@ -1415,8 +1672,22 @@ void MainWindow::loadPreferences()
     promptBeforeOverwrite = settings.value("promptBeforeOverwrite", true).toBool();
     fileNamingPolicy = settings.value("fileNamingPolicy", "Use original name").toString();
     maxConcurrentDownloads = settings.value("maxConcurrentDownloads", 3).toInt();
+    progressRate = settings.value("progressRate", 10).toInt();
+    largeFileMode = settings.value("largeFileMode", false).toBool();
+    hostSpeedLimits = settings.value("hostSpeedLimits").toMap();
+    chunkFiles = settings.value("chunkFiles", false).toBool();
+    chunkDirectory = settings.value("chunkDirectory").toString();
+    defaultTransport = transportFromName(settings.value("transport").toString(), DownloadItem::QtNetwork);
+    shareHttp2Connections = settings.value("shareHttp2Connections", true).toBool();
     if (m_downloadManager) {
         m_downloadManager->setMaxConcurrentDownloads(maxConcurrentDownloads);
+        m_downloadManager->setProgressRate(progressRate);
+        m_downloadManager->setLargeFileMode(largeFileMode);
+        m_downloadManager->setDefaultTransport(defaultTransport);
+        m_downloadManager->setShareHttp2Connections(shareHttp2Connections);
+        for (auto it = hostSpeedLimits.cbegin(); it != hostSpeedLimits.cend(); ++it) {
+            m_downloadManager->setHostSpeedLimit(it.key(), it.value().toLongLong() * 1024);
+        }
     }
 }
 
@@ -1427,6 +1698,13 @@ void MainWindow::savePreferences()
     settings.setValue("promptBeforeOverwrite", promptBeforeOverwrite);
     settings.setValue("fileNamingPolicy", fileNamingPolicy);
     settings.setValue("maxConcurrentDownloads", maxConcurrentDownloads);
+    settings.setValue("progressRate", progressRate);
+    settings.setValue("largeFileMode", largeFileMode);
+    settings.setValue("hostSpeedLimits", hostSpeedLimits);
+    settings.setValue("chunkFiles", chunkFiles);
+    settings.setValue("chunkDirectory", chunkDirectory);
+    settings.setValue("transport", transportName(defaultTransport));
+    settings.setValue("shareHttp2Connections", shareHttp2Connections);
     settings.sync();
 }
 
@@ -1475,7 +1753,7 @@ void MainWindow::downloadFromYouTube()
         QString filePath = dialog.getOutputPath();
         if (!filePath.isEmpty()) {
             QString fileName = dialog.getYtdlArgs().contains("--extract-audio") ? "audio.mp3" : "video.mp4";
-            auto *item = new DownloadItem(youtubeUrl, QDir(filePath).filePath(fileName), this); // Ensure valid path
+            auto *item = new DownloadItem(youtubeUrl, QDir(filePath).filePath(fileName)); // Ensure valid path
             item->setNumChunks(8);
             item->setState(DownloadItem::Queued);
             item->setLastTryDate(QDateTime::currentDateTime());
@@ -1487,6 +1765,7 @@ void MainWindow::downloadFromYouTube()
             connect(item, &DownloadItem::finished, this, &MainWindow::handleDownloadFinished, Qt::QueuedConnection);
             connect(item, &DownloadItem::failed, this, &MainWindow::handleDownloadFailed, Qt::QueuedConnection);
             connect(item, &DownloadItem::stateChanged, this, &MainWindow::scheduleTableUpdate, Qt::QueuedConnection);
+            connect(item, &DownloadItem::mergeProgress, this, &MainWindow::handleMergeProgress, Qt::QueuedConnection);
 
             QStringList ytdlArgs = dialog.getYtdlArgs();
             if (!ytdlArgs.contains("--add-header")) ytdlArgs << "--add-header" << "User-Agent:Mozilla/5.0"; // Ensure header
@@ -40,6 +40,7 @@ private slots:
     void handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void handleDownloadFinished();
     void handleDownloadFailed(const QString &reason);
+    void handleMergeProgress(qint64 bytesMerged, qint64 bytesTotal);
     void openSpeedLimiterDialog();
     void openPreferences();
     void toggleSpeedLimiter(bool enabled);
@@ -48,8 +49,10 @@ private slots:
     void showContextMenu(const QPoint &pos);
     void retryDownload(DownloadItem *item);
     void openFile(DownloadItem *item);
+    void streamDownload(DownloadItem *item);
     void deleteDownload(DownloadItem *item);
     void copyUrl(DownloadItem *item);
+    void limitHostSpeed(DownloadItem *item);
     void downloadFromYouTube(); // New slot for YouTube download
     void newConnection();
     void readClient();
@@ -72,6 +75,14 @@ private:
     bool promptBeforeOverwrite = true;
     QString fileNamingPolicy = "Use original name";
     int maxConcurrentDownloads = 3;
+    int progressRate = 10; // Progress publications per second and item
+    bool largeFileMode = false; // Downloads bypass the page cache as far as possible
+    QVariantMap hostSpeedLimits; // Host name -> KB/s, shared by all downloads from it
+    bool chunkFiles = false; // New downloads keep each segment in a file of its own until merged
+    QString chunkDirectory; // Where those files go; empty: next to the target
+    QHash<DownloadItem*, int> mergePercent; // Chunk-file items being merged
+    DownloadItem::Transport defaultTransport = DownloadItem::QtNetwork; // For items without a choice of their own
+    bool shareHttp2Connections = true; // HTTP/2 items to one origin share a connection
     QSettings settings{"Advanced", "IDMApp"};
     AboutDialog *aboutDialog;
     QMenu *contextMenu;
@@ -80,21 +91,29 @@ private:
     QAction *stopAction;
     QAction *retryAction;
     QAction *openFileAction;
+    QAction *streamAction;
     QAction *deleteAction;
     QAction *copyUrlAction;
+    QAction *hostLimitAction;
+    QMenu *transportMenu;
+    QActionGroup *transportGroup; // Data: a DownloadItem::Transport, or -1 for the default
     QAction *youtubeAction;
     QAction *detailsAction;
     QAction *updatelink;
     QAction *openfilelocation;
     QTcpServer *m_server;
+    QByteArray m_streamToken; // Random per run; /stream/ URLs without it are refused
     QMap<QByteArray, bool> m_pendingRequests;
     DownloadConfirmationDialog *m_confirmationDialog;
     QStringList m_categories;
 
     DownloadItem* getDownloadItemForRow(int row);
     void init();
-    void addDownload(const QUrl &url, const QString &path);
-    void addDownload(const QUrl &url, const QString &path, const QString &category, const QString &customFileName, bool showYouTubeDialog); // New enhanced version
+    void addDownload(const QUrl &url, const QString &path, const QString &checksum = QString(), const QList<QUrl> &mirrors = {});
+    void addDownload(const QUrl &url, const QString &path, const QString &category, const QString &customFileName, bool showYouTubeDialog,
+                     const QString &checksum = QString(), const QList<QUrl> &mirrors = {}); // New enhanced version
+    void addMetalink(const QUrl &url);
+    void addMetalinkFiles(const QByteArray &xml);
     void updateDownloadTable();
     void scheduleTableUpdate();
     void saveDownloadListToFile(const QString& filename);
@@ -125,9 +144,11 @@ private:
     void addCategory(const QString& category);
     void setMaxConcurrentDownloads(int max);
     void updateContextMenuActions(DownloadItem *item);
+    void applyWriteMode(DownloadItem *item);
     bool isYouTubeUrl(const QString &url); // New helper method
     void processYouTubeDownload(const QString &url); // New helper method
     void loadExtensionsUI();
+    void serveStream(QTcpSocket *socket, const QByteArray &request);
     QStringList getCategories() const;
 
 
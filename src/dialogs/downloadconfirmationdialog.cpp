@@ -64,4 +64,9 @@ QDateTime DownloadConfirmationDialog::getScheduledStart() const
 bool DownloadConfirmationDialog::isHighPriority() const
 {
     return ui->priorityCheckBox->isChecked();
-}
\ No newline at end of file
+}
+
+QString DownloadConfirmationDialog::getChecksum() const
+{
+    return ui->checksumLineEdit->text().trimmed();
+}
@@ -23,6 +23,7 @@ public:
     int getSpeedLimit() const;
     QDateTime getScheduledStart() const;
     bool isHighPriority() const;
+    QString getChecksum() const; // As typed: a digest or the URL of a checksum file
 
 private slots:
     void on_buttonBox_accepted();
@@ -132,16 +132,18 @@ void DownloadDetailsDialog::updateDetails()
 {
     if (!m_item) return;
 
-    ui->downloadedSizeValueLabel->setText(formatSize(m_item->getDownloadedSize()));
-    ui->transferRateValueLabel->setText(m_item->getTransferRate() > 0 ? QString("%1/s").arg(formatSize(m_item->getTransferRate())) : "N/A");
+    // One consistent view of what the item last published
+    const DownloadItem::ProgressSnapshot snapshot = m_item->getProgressSnapshot();
+    ui->downloadedSizeValueLabel->setText(formatSize(snapshot.downloaded));
+    ui->transferRateValueLabel->setText(snapshot.rate > 0 ? QString("%1/s").arg(formatSize(snapshot.rate)) : "N/A");
 
     int numChunks = m_item->getNumChunks();
     if (numChunks == 1 && m_singleChunkProgressBar) {
-        qint64 downloaded = m_item->getDownloadedSize();
+        qint64 downloaded = snapshot.downloaded;
         m_singleChunkProgressBar->setValue(downloaded);
-        if (m_item->getTotalSize() > 0) {
-            int percentage = (downloaded * 100) / m_item->getTotalSize();
-            m_singleChunkProgressBar->setFormat(QString("%1/%2 (%3%)").arg(formatSize(downloaded)).arg(formatSize(m_item->getTotalSize())).arg(percentage));
+        if (snapshot.total > 0) {
+            int percentage = (downloaded * 100) / snapshot.total;
+            m_singleChunkProgressBar->setFormat(QString("%1/%2 (%3%)").arg(formatSize(downloaded)).arg(formatSize(snapshot.total)).arg(percentage));
         } else {
             m_singleChunkProgressBar->setFormat(QString("%1/N/A").arg(formatSize(downloaded)));
         }
@@ -151,9 +153,9 @@ void DownloadDetailsDialog::updateDetails()
             if (item && item->widget()) {
                 QProgressBar *progressBar = qobject_cast<QProgressBar*>(item->widget());
                 if (progressBar) {
-                    qint64 chunkProgress = m_item->getChunkProgress(i);
+                    qint64 chunkProgress = i < snapshot.segments.size() ? snapshot.segments[i] : m_item->getChunkProgress(i);
                     progressBar->setValue(chunkProgress);
-                    qint64 chunkTotal = m_item->getTotalSize() / numChunks;
+                    qint64 chunkTotal = snapshot.total / numChunks;
                     if (chunkTotal > 0) {
                         int percentage = (chunkProgress * 100) / chunkTotal;
                         progressBar->setFormat(QString("%1/%2 (%3%)").arg(formatSize(chunkProgress)).arg(formatSize(chunkTotal)).arg(percentage));
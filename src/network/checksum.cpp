@@ -0,0 +1,199 @@
+#include "checksum.h"
+#include "crc32c.h"
+#include <QFileInfo>
+#include <QNetworkReply>
+#include <QRegularExpression>
+#include <QtEndian>
+
+namespace {
+QCryptographicHash::Algorithm cryptographicAlgorithm(Checksum::Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Checksum::Md5: return QCryptographicHash::Md5;
+    case Checksum::Sha1: return QCryptographicHash::Sha1;
+    default: return QCryptographicHash::Sha256; // Also a placeholder for CRC-32C
+    }
+}
+
+// Higher is preferred when a server offers several digests
+int strength(Checksum::Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Checksum::Sha256: return 4;
+    case Checksum::Sha1: return 3;
+    case Checksum::Md5: return 2;
+    case Checksum::Crc32c: return 1;
+    default: return 0;
+    }
+}
+
+bool isHex(const QByteArray &text)
+{
+    static const QRegularExpression hex("^[0-9a-fA-F]+$");
+    return hex.match(QString::fromLatin1(text)).hasMatch();
+}
+
+// "name=value, name=value" as used by Digest, Repr-Digest and x-goog-hash
+void parseDigestList(const QByteArray &header, QList<Checksum> *found)
+{
+    for (const QByteArray &entry : header.split(',')) {
+        const int eq = entry.indexOf('=');
+        if (eq <= 0) continue;
+        Checksum::Algorithm algorithm = Checksum::algorithmFromName(QString::fromLatin1(entry.left(eq)));
+        QByteArray value = entry.mid(eq + 1).trimmed();
+        if (value.startsWith(':') && value.endsWith(':')) value = value.mid(1, value.size() - 2); // Structured field bytes
+        Checksum checksum(algorithm, QByteArray::fromBase64(value));
+        if (checksum.isValid()) found->append(checksum);
+    }
+}
+}
+
+QString Checksum::toString() const
+{
+    if (!isValid()) return QString();
+    return algorithmName(m_algorithm) + ':' + QString::fromLatin1(m_digest.toHex());
+}
+
+QString Checksum::algorithmName(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Md5: return QStringLiteral("md5");
+    case Sha1: return QStringLiteral("sha1");
+    case Sha256: return QStringLiteral("sha256");
+    case Crc32c: return QStringLiteral("crc32c");
+    default: return QString();
+    }
+}
+
+Checksum::Algorithm Checksum::algorithmFromName(QString name)
+{
+    name = name.trimmed().toLower().remove('-');
+    if (name == "sha256") return Sha256;
+    if (name == "sha1" || name == "sha") return Sha1;
+    if (name == "md5") return Md5;
+    if (name == "crc32c") return Crc32c;
+    return None;
+}
+
+int Checksum::digestLength(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Md5: return 16;
+    case Sha1: return 20;
+    case Sha256: return 32;
+    case Crc32c: return 4;
+    default: return 0;
+    }
+}
+
+Checksum::Algorithm Checksum::algorithmForUrl(const QUrl &url)
+{
+    const QString suffix = QFileInfo(url.path()).suffix().toLower();
+    if (suffix == "sha256") return Sha256;
+    if (suffix == "sha1") return Sha1;
+    if (suffix == "md5") return Md5;
+    return None;
+}
+
+Checksum Checksum::fromString(const QString &text)
+{
+    const QString trimmed = text.trimmed();
+    const int separator = trimmed.indexOf(QRegularExpression("[:=]"));
+    Algorithm algorithm = None;
+    QByteArray value = trimmed.toLatin1();
+    if (separator > 0) {
+        algorithm = algorithmFromName(trimmed.left(separator));
+        value = trimmed.mid(separator + 1).trimmed().toLatin1();
+    }
+    if (!isHex(value)) return Checksum();
+    if (algorithm == None) {
+        for (Algorithm candidate : {Sha256, Sha1, Md5, Crc32c}) {
+            if (value.size() == 2 * digestLength(candidate)) algorithm = candidate;
+        }
+    }
+    return Checksum(algorithm, QByteArray::fromHex(value));
+}
+
+Checksum Checksum::fromHeaders(const QNetworkReply *reply, bool partialContent)
+{
+    QList<Checksum> found;
+    parseDigestList(reply->rawHeader("Repr-Digest"), &found);
+    parseDigestList(reply->rawHeader("Digest"), &found);
+    parseDigestList(reply->rawHeader("x-goog-hash"), &found);
+    const QByteArray contentMd5 = partialContent ? QByteArray() : reply->rawHeader("Content-MD5").trimmed();
+    if (!contentMd5.isEmpty()) {
+        Checksum md5(Md5, QByteArray::fromBase64(contentMd5));
+        if (md5.isValid()) found.append(md5);
+    }
+
+    Checksum best;
+    for (const Checksum &checksum : std::as_const(found)) {
+        if (strength(checksum.algorithm()) > strength(best.algorithm())) best = checksum;
+    }
+    return best;
+}
+
+Checksum Checksum::fromChecksumFile(const QByteArray &content, const QString &fileName, Algorithm algorithm)
+{
+    static const QRegularExpression bsdLine(R"(^\S+\s*\((.*)\)\s*=\s*([0-9a-fA-F]+)$)");
+    static const QRegularExpression gnuLine(R"(^([0-9a-fA-F]+)(?:\s+\*?(.*))?$)");
+
+    QList<QPair<QString, QString>> entries; // Name, hex
+    for (const QByteArray &rawLine : content.split('\n')) {
+        const QString line = QString::fromUtf8(rawLine).trimmed();
+        if (line.isEmpty() || line.startsWith('#')) continue;
+        QRegularExpressionMatch match = bsdLine.match(line);
+        if (match.hasMatch()) {
+            entries.append({match.captured(1), match.captured(2)});
+            continue;
+        }
+        match = gnuLine.match(line);
+        if (match.hasMatch()) entries.append({match.captured(2).trimmed(), match.captured(1)});
+    }
+
+    QString hex;
+    for (const auto &entry : std::as_const(entries)) {
+        if (QFileInfo(entry.first).fileName() == fileName) hex = entry.second;
+    }
+    if (hex.isEmpty() && entries.size() == 1) hex = entries.first().second;
+    if (hex.isEmpty()) return Checksum();
+
+    Checksum checksum = algorithm == None ? fromString(hex) : Checksum(algorithm, QByteArray::fromHex(hex.toLatin1()));
+    return checksum.isValid() ? checksum : Checksum();
+}
+
+StreamHasher::StreamHasher(Checksum::Algorithm algorithm)
+    : m_algorithm(algorithm), m_hash(cryptographicAlgorithm(algorithm))
+{
+}
+
+qint64 StreamHasher::addData(qint64 offset, const char *data, qint64 len)
+{
+    if (offset > m_position || offset + len <= m_position) return 0;
+    const qint64 skip = m_position - offset;
+    const qint64 count = len - skip;
+    if (m_algorithm == Checksum::Crc32c) {
+        m_crc = crc32cUpdate(m_crc, data + skip, count);
+    } else {
+        m_hash.addData(QByteArrayView(data + skip, count));
+    }
+    m_position += count;
+    return count;
+}
+
+Checksum StreamHasher::result() const
+{
+    if (m_algorithm == Checksum::Crc32c) {
+        QByteArray digest(4, Qt::Uninitialized);
+        qToBigEndian(m_crc, digest.data());
+        return Checksum(m_algorithm, digest);
+    }
+    return Checksum(m_algorithm, m_hash.resultView().toByteArray());
+}
+
+void StreamHasher::reset()
+{
+    m_hash.reset();
+    m_crc = 0;
+    m_position = 0;
+}
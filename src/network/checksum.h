@@ -0,0 +1,72 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <QUrl>
+
+class QNetworkReply;
+
+/**
+ * @brief An expected (or computed) digest of a whole file.
+ */
+class Checksum
+{
+public:
+    enum Algorithm { None, Md5, Sha1, Sha256, Crc32c };
+
+    Checksum() = default;
+    Checksum(Algorithm algorithm, const QByteArray &digest) : m_algorithm(algorithm), m_digest(digest) {}
+
+    bool isValid() const { return m_algorithm != None && m_digest.size() == digestLength(m_algorithm); }
+    Algorithm algorithm() const { return m_algorithm; }
+    QByteArray digest() const { return m_digest; } // Raw bytes
+    QString toString() const;                      // "sha256:<hex>"
+    bool operator==(const Checksum &other) const { return m_algorithm == other.m_algorithm && m_digest == other.m_digest; }
+    bool operator!=(const Checksum &other) const { return !(*this == other); }
+
+    static QString algorithmName(Algorithm algorithm);
+    static Algorithm algorithmFromName(QString name);
+    static int digestLength(Algorithm algorithm);
+    // Picked by extension: .sha256, .sha1, .md5
+    static Algorithm algorithmForUrl(const QUrl &url);
+
+    // "sha256:<hex>", "sha-256=<hex>" or bare hex (the length tells which)
+    static Checksum fromString(const QString &text);
+    // Repr-Digest / Digest / Content-MD5 / x-goog-hash; the strongest one wins.
+    // For a 206 Content-MD5 covers only the part and is skipped.
+    static Checksum fromHeaders(const QNetworkReply *reply, bool partialContent = false);
+    // sha256sum style ("<hex>  <name>") or BSD style ("SHA256 (<name>) = <hex>")
+    static Checksum fromChecksumFile(const QByteArray &content, const QString &fileName, Algorithm algorithm);
+
+private:
+    Algorithm m_algorithm = None;
+    QByteArray m_digest;
+};
+
+/**
+ * @brief Hashes a file in order while its ranges arrive in any order: data at
+ * position() is consumed, anything else is left for the caller to feed again
+ * later (from the file).
+ */
+class StreamHasher
+{
+public:
+    explicit StreamHasher(Checksum::Algorithm algorithm);
+
+    Checksum::Algorithm algorithm() const { return m_algorithm; }
+    qint64 position() const { return m_position; }
+    // Consumes the part of [offset, offset + len) that continues position()
+    qint64 addData(qint64 offset, const char *data, qint64 len);
+    Checksum result() const;
+    void reset();
+
+private:
+    Checksum::Algorithm m_algorithm;
+    QCryptographicHash m_hash;
+    quint32 m_crc = 0;
+    qint64 m_position = 0;
+};
+
+#endif // CHECKSUM_H
@@ -0,0 +1,123 @@
+#include "chunkmerger.h"
+#include "segmentfile.h"
+#include <QFile>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <cerrno>
+#endif
+
+namespace {
+constexpr qint64 kKernelSliceSize = 8 * 1024 * 1024; // Bytes per copy_file_range/sendfile call
+constexpr qint64 kBufferSize = 1024 * 1024;          // Buffer for the portable fallback
+}
+
+ChunkMerger::ChunkMerger(const QString &targetPath, const QList<Part> &parts, qint64 totalSize, QObject *parent)
+    : QObject(parent), m_targetPath(targetPath), m_parts(parts), m_totalSize(totalSize)
+{
+}
+
+void ChunkMerger::run()
+{
+    SegmentFile target(m_targetPath);
+    if (!target.open(m_totalSize)) {
+        emit finished(false, "Cannot open final file for merging: " + target.errorString());
+        return;
+    }
+
+    for (int i = 0; i < m_parts.size(); ++i) {
+        QFile source(m_parts[i].path);
+        if (!source.open(QIODevice::ReadOnly)) {
+            target.close();
+            emit finished(false, QString("Could not read chunk %1 for merging").arg(i));
+            return;
+        }
+
+        QString error;
+        if (!copyPart(source, target, m_parts[i], error)) {
+            target.close();
+            emit finished(false, error);
+            return;
+        }
+    }
+
+    target.close();
+    qDebug() << "ChunkMerger: merged" << m_merged << "bytes into" << m_targetPath;
+    emit finished(true, QString());
+}
+
+bool ChunkMerger::copyPart(QFile &source, SegmentFile &target, const Part &part, QString &error)
+{
+    qint64 copied = 0;
+#ifdef Q_OS_LINUX
+    copied = kernelCopy(source.handle(), target.handle(), part);
+#endif
+    if (copied >= part.length) return true;
+
+    // Buffered fallback for whatever the kernel path did not copy
+    if (!source.seek(copied)) {
+        error = "Cannot seek in chunk file: " + source.errorString();
+        return false;
+    }
+    QByteArray buffer(kBufferSize, Qt::Uninitialized);
+    while (copied < part.length) {
+        if (m_cancelled.loadRelaxed()) {
+            error = "Merge cancelled";
+            return false;
+        }
+        qint64 n = source.read(buffer.data(), qMin(kBufferSize, part.length - copied));
+        if (n <= 0) {
+            error = "Chunk file is shorter than expected: " + source.fileName();
+            return false;
+        }
+        if (target.writeAt(part.offset + copied, buffer.constData(), n) != n) {
+            error = "Failed to write merged file: " + target.errorString();
+            return false;
+        }
+        copied += n;
+        m_merged += n;
+        emit progress(m_merged, m_totalSize);
+    }
+    return true;
+}
+
+/**
+ * @brief Copies as much of the part as possible without going through user space.
+ * @return Bytes copied; the caller finishes the rest with a buffered copy.
+ */
+qint64 ChunkMerger::kernelCopy(int inFd, int outFd, const Part &part)
+{
+    qint64 copied = 0;
+#ifdef Q_OS_LINUX
+    bool useCopyFileRange = true;
+    while (copied < part.length && !m_cancelled.loadRelaxed()) {
+        size_t len = static_cast<size_t>(qMin(kKernelSliceSize, part.length - copied));
+        ssize_t n;
+        if (useCopyFileRange) {
+            loff_t inOffset = copied;
+            loff_t outOffset = part.offset + copied;
+            n = ::copy_file_range(inFd, &inOffset, outFd, &outOffset, len, 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                useCopyFileRange = false; // e.g. chunks on another filesystem
+                continue;
+            }
+        } else {
+            off_t inOffset = copied;
+            if (::lseek(outFd, part.offset + copied, SEEK_SET) < 0) break;
+            n = ::sendfile(outFd, inFd, &inOffset, len);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += n;
+        m_merged += n;
+        emit progress(m_merged, m_totalSize);
+    }
+#else
+    Q_UNUSED(inFd);
+    Q_UNUSED(outFd);
+    Q_UNUSED(part);
+#endif
+    return copied;
+}
@@ -0,0 +1,51 @@
+#ifndef CHUNKMERGER_H
+#define CHUNKMERGER_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QAtomicInt>
+
+class QFile;
+class SegmentFile;
+
+/**
+ * @brief Assembles .chunkN files into the final file on a worker thread.
+ *
+ * Data is streamed in bounded slices. On Linux the copy is done in-kernel with
+ * copy_file_range (or sendfile) and falls back to a buffered copy elsewhere or
+ * when the filesystems involved do not support it.
+ */
+class ChunkMerger : public QObject
+{
+    Q_OBJECT
+public:
+    struct Part {
+        QString path;    // Chunk file to read
+        qint64 offset;   // Where its data starts in the final file
+        qint64 length;   // Expected number of bytes in the chunk file
+    };
+
+    ChunkMerger(const QString &targetPath, const QList<Part> &parts, qint64 totalSize, QObject *parent = nullptr);
+
+    void cancel() { m_cancelled.storeRelaxed(1); }
+
+public slots:
+    void run();
+
+signals:
+    void progress(qint64 bytesMerged, qint64 bytesTotal);
+    void finished(bool ok, const QString &error);
+
+private:
+    bool copyPart(QFile &source, SegmentFile &target, const Part &part, QString &error);
+    qint64 kernelCopy(int inFd, int outFd, const Part &part);
+
+    QString m_targetPath;
+    QList<Part> m_parts;
+    qint64 m_totalSize;
+    qint64 m_merged = 0;
+    QAtomicInt m_cancelled;
+};
+
+#endif // CHUNKMERGER_H
@@ -0,0 +1,96 @@
+#include "connectioncontroller.h"
+#include <QDebug>
+
+namespace {
+constexpr int kSettleSamples = 2;      // Samples to let a change take effect before judging it
+constexpr int kProbeHoldSamples = 30;  // Samples to wait after a plateau before probing again
+constexpr double kMinGain = 0.10;      // Gain an extra connection must bring to be kept
+constexpr double kStrongGain = 0.50;   // Gain that doubles the count instead of adding one
+}
+
+ConnectionController::ConnectionController(int initial, int maximum)
+    : m_initial(qMax(1, initial)), m_maximum(qMax(1, maximum))
+{
+    reset();
+}
+
+void ConnectionController::reset()
+{
+    m_ceiling = m_maximum;
+    m_target = qMin(m_initial, m_ceiling);
+    m_previousTarget = m_target;
+    m_samplesSinceChange = 0;
+    m_holdSamples = 0;
+    m_samplesSinceThrottle = kSettleSamples;
+    m_quietSamples = 0;
+    m_smoothedRate = 0;
+    m_baselineRate = 0;
+}
+
+void ConnectionController::setMaximum(int maximum)
+{
+    m_maximum = qMax(1, maximum);
+    m_ceiling = qMin(m_ceiling, m_maximum);
+    if (m_target > m_ceiling) changeTarget(m_ceiling);
+}
+
+int ConnectionController::sample(qint64 bytesPerSecond)
+{
+    m_smoothedRate = m_smoothedRate <= 0 ? bytesPerSecond : 0.5 * m_smoothedRate + 0.5 * bytesPerSecond;
+    ++m_samplesSinceThrottle;
+    if (m_ceiling < m_maximum && ++m_quietSamples >= kProbeHoldSamples) {
+        // The server has been quiet for a while: allow probing one step higher
+        ++m_ceiling;
+        m_quietSamples = 0;
+        qDebug() << "ConnectionController: no throttling lately, ceiling back at" << m_ceiling << "connections";
+    }
+    if (++m_samplesSinceChange < kSettleSamples) return m_target;
+
+    if (m_holdSamples > 0) {
+        if (--m_holdSamples == 0) m_baselineRate = 0; // Probe again from the current level
+        return m_target;
+    }
+
+    if (m_baselineRate <= 0) {
+        // First judgement at this level: try one more connection
+        if (m_target < m_ceiling) {
+            m_baselineRate = m_smoothedRate;
+            changeTarget(m_target + 1);
+        }
+        return m_target;
+    }
+
+    const double gain = (m_smoothedRate - m_baselineRate) / m_baselineRate;
+    if (gain >= kMinGain && m_target < m_ceiling) {
+        m_baselineRate = m_smoothedRate;
+        changeTarget(gain >= kStrongGain ? qMin(m_target * 2, m_ceiling) : m_target + 1);
+    } else if (gain < kMinGain) {
+        // Plateau: the last increase did not pay off, so give it back
+        qDebug() << "ConnectionController: plateau at" << m_target << "connections, gain" << gain;
+        changeTarget(qMin(m_target, m_previousTarget));
+        m_holdSamples = kProbeHoldSamples;
+    }
+    return m_target;
+}
+
+int ConnectionController::onThrottled()
+{
+    // Every segment open at the time reports the same push-back: count it once
+    if (m_samplesSinceThrottle < kSettleSamples) return m_target;
+    m_samplesSinceThrottle = 0;
+    m_quietSamples = 0;
+    m_ceiling = qMax(1, m_target - 1);
+    qDebug() << "ConnectionController: server throttled, capping at" << m_ceiling << "connections";
+    changeTarget(m_ceiling);
+    m_holdSamples = kProbeHoldSamples;
+    return m_target;
+}
+
+void ConnectionController::changeTarget(int target)
+{
+    target = qBound(1, target, m_ceiling);
+    if (target == m_target) return;
+    m_previousTarget = m_target;
+    m_target = target;
+    m_samplesSinceChange = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef CONNECTIONCONTROLLER_H
+#define CONNECTIONCONTROLLER_H
+
+#include <QtGlobal>
+
+/**
+ * @brief Decides how many connections a segmented download should use.
+ *
+ * Starts small and keeps adding connections while the measured aggregate
+ * throughput keeps rising. When an added connection brings no real gain it is
+ * given back and probing pauses for a while. A 429/503 from the server lowers
+ * the ceiling by one; a burst of them counts once. After a quiet while the
+ * ceiling is raised again one step at a time.
+ */
+class ConnectionController
+{
+public:
+    explicit ConnectionController(int initial = 2, int maximum = 32);
+
+    void reset();
+    void setMaximum(int maximum);
+    int target() const { return m_target; }
+    int maximum() const { return m_maximum; }
+
+    // Feed one throughput sample (bytes/s); returns the new connection target
+    int sample(qint64 bytesPerSecond);
+    // The server pushed back (429/503); returns the new connection target
+    int onThrottled();
+
+private:
+    void changeTarget(int target);
+
+    int m_initial;
+    int m_maximum;
+    int m_ceiling;               // m_maximum, lowered when the server pushes back
+    int m_target;
+    int m_previousTarget;
+    int m_samplesSinceChange = 0;
+    int m_holdSamples = 0;       // Samples to wait before probing again
+    int m_samplesSinceThrottle = 0;
+    int m_quietSamples = 0;      // Since the ceiling last moved, without throttling
+    double m_smoothedRate = 0;
+    double m_baselineRate = 0;   // Rate measured before the last increase
+};
+
+#endif // CONNECTIONCONTROLLER_H
@@ -0,0 +1,148 @@
+#include "connectionpool.h"
+#include "nativehttpclient.h"
+#include <QNetworkAccessManager>
+#include <QThread>
+#include <QDebug>
+
+ConnectionPool::ConnectionPool(QObject *parent)
+    : QObject(parent)
+{
+    connect(&m_evictTimer, &QTimer::timeout, this, &ConnectionPool::evictIdle);
+    m_evictTimer.start(10000);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    QMutexLocker locker(&m_mutex);
+    for (const Entry &entry : std::as_const(m_entries)) destroyEntry(entry);
+    m_entries.clear();
+}
+
+void ConnectionPool::destroyEntry(const Entry &entry)
+{
+    for (QObject *object : {static_cast<QObject*>(entry.manager), static_cast<QObject*>(entry.nativeClient)}) {
+        if (!object) continue;
+        // One on a worker that already stopped can be deleted from here
+        if (object->thread()->isFinished() || object->thread() == QThread::currentThread()) delete object;
+        else object->deleteLater();
+    }
+}
+
+QString ConnectionPool::hostKey(const QUrl &url)
+{
+    return QString("%1://%2:%3").arg(url.scheme(), url.host().toLower())
+        .arg(url.port(url.scheme() == "https" ? 443 : 80));
+}
+
+QString ConnectionPool::proxyKey(const QNetworkProxy &proxy)
+{
+    if (proxy.type() == QNetworkProxy::NoProxy || proxy.type() == QNetworkProxy::DefaultProxy) {
+        return QString::number(proxy.type());
+    }
+    return QString("%1:%2@%3:%4").arg(proxy.type()).arg(proxy.user(), proxy.hostName()).arg(proxy.port());
+}
+
+/**
+ * @brief Lends out the calling thread's manager for this origin and proxy,
+ * creating it on first use. Pair every call with release().
+ */
+QNetworkAccessManager *ConnectionPool::acquire(const QUrl &url, const QNetworkProxy &proxy)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = entryFor(url, proxy);
+    if (!entry.manager) {
+        entry.manager = new QNetworkAccessManager; // No parent: owned by the pool, lives on this thread
+        entry.manager->setProxy(proxy);
+    }
+    ++entry.users;
+    return entry.manager;
+}
+
+/**
+ * @brief Same as acquire() for the native HTTP/1.1 transport.
+ */
+NativeHttpClient *ConnectionPool::acquireNativeClient(const QUrl &url, const QNetworkProxy &proxy)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = entryFor(url, proxy);
+    if (!entry.nativeClient) {
+        entry.nativeClient = new NativeHttpClient;
+        entry.nativeClient->setProxy(proxy);
+    }
+    ++entry.users;
+    return entry.nativeClient;
+}
+
+ConnectionPool::Entry &ConnectionPool::entryFor(const QUrl &url, const QNetworkProxy &proxy)
+{
+    const QString key = QString("%1|%2|%3")
+                            .arg(quintptr(QThread::currentThread()))
+                            .arg(hostKey(url), proxyKey(proxy));
+    if (!m_entries.contains(key)) qDebug() << "ConnectionPool: new entry for" << key;
+    return m_entries[key];
+}
+
+void ConnectionPool::release(QObject *borrowed)
+{
+    QMutexLocker locker(&m_mutex);
+    for (Entry &entry : m_entries) {
+        if (entry.manager == borrowed || entry.nativeClient == borrowed) {
+            if (--entry.users == 0) entry.idleSince.start();
+            return;
+        }
+    }
+}
+
+bool ConnectionPool::reserveConnection(const QString &hostKey)
+{
+    QMutexLocker locker(&m_mutex);
+    int &open = m_openConnections[hostKey];
+    if (open >= m_maxPerHost) return false;
+    ++open;
+    return true;
+}
+
+void ConnectionPool::releaseConnection(const QString &hostKey)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_openConnections.find(hostKey);
+    if (it == m_openConnections.end()) return;
+    if (--it.value() <= 0) m_openConnections.erase(it);
+}
+
+void ConnectionPool::markRangeUnsupported(const QString &hostKey)
+{
+    QMutexLocker locker(&m_mutex);
+    m_rangeUnsupported.insert(hostKey);
+}
+
+bool ConnectionPool::isRangeUnsupported(const QString &hostKey)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_rangeUnsupported.contains(hostKey);
+}
+
+void ConnectionPool::setMaxConnectionsPerHost(int max)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxPerHost = qMax(1, max);
+}
+
+/**
+ * @brief Drops managers (and with them their keep-alive sockets) that have
+ * not been borrowed for m_idleTimeoutMs.
+ */
+void ConnectionPool::evictIdle()
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        Entry &entry = it.value();
+        if (entry.users == 0 && entry.idleSince.isValid() && entry.idleSince.elapsed() >= m_idleTimeoutMs) {
+            qDebug() << "ConnectionPool: evicting idle manager" << it.key();
+            destroyEntry(entry); // Deleted on its own thread
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
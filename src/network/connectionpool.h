@@ -0,0 +1,76 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QNetworkProxy>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class NativeHttpClient;
+
+/**
+ * @brief Network access managers shared by all downloads, so keep-alive
+ * TCP/TLS connections to a host outlive the item that opened them.
+ *
+ * A QNetworkAccessManager may only be used from the thread that created it,
+ * so managers are keyed by thread as well as scheme+host+port+proxy. The pool
+ * also caps the number of connections open to one host across all items.
+ * Managers nobody has borrowed for a while are dropped with their connections.
+ */
+class ConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ConnectionPool(QObject *parent = nullptr);
+    ~ConnectionPool();
+
+    // Thread-safe; the manager belongs to the calling thread
+    QNetworkAccessManager *acquire(const QUrl &url, const QNetworkProxy &proxy);
+    NativeHttpClient *acquireNativeClient(const QUrl &url, const QNetworkProxy &proxy);
+    void release(QObject *borrowed);
+
+    // Per-host connection slots shared by every item
+    bool reserveConnection(const QString &hostKey);
+    void releaseConnection(const QString &hostKey);
+
+    // Hosts seen answering a range request with something else; items for them
+    // skip multi-segment mode for the rest of the session
+    void markRangeUnsupported(const QString &hostKey);
+    bool isRangeUnsupported(const QString &hostKey);
+
+    void setMaxConnectionsPerHost(int max);
+    int maxConnectionsPerHost() const { return m_maxPerHost; }
+    void setIdleTimeout(int msecs) { m_idleTimeoutMs = msecs; }
+
+    static QString hostKey(const QUrl &url);
+
+private slots:
+    void evictIdle();
+
+private:
+    struct Entry {
+        QNetworkAccessManager *manager = nullptr;
+        NativeHttpClient *nativeClient = nullptr;
+        int users = 0;
+        QElapsedTimer idleSince;
+    };
+
+    static QString proxyKey(const QNetworkProxy &proxy);
+    Entry &entryFor(const QUrl &url, const QNetworkProxy &proxy);
+    static void destroyEntry(const Entry &entry);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    QHash<QString, int> m_openConnections;
+    QSet<QString> m_rangeUnsupported;
+    int m_maxPerHost = 16;
+    int m_idleTimeoutMs = 60000;
+    QTimer m_evictTimer;
+};
+
+#endif // CONNECTIONPOOL_H
@@ -0,0 +1,148 @@
+#include "crc32c.h"
+#include <QtEndian>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define IDM_CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define IDM_CRC32C_ARM
+#endif
+
+namespace {
+constexpr quint32 kPolynomial = 0x82F63B78; // Reflected Castagnoli
+
+// Slicing-by-8 tables for the portable path
+struct Tables {
+    quint32 t[8][256];
+    Tables()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (kPolynomial & (0u - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (quint32 i = 0; i < 256; ++i) {
+            for (int slice = 1; slice < 8; ++slice) t[slice][i] = (t[slice - 1][i] >> 8) ^ t[0][t[slice - 1][i] & 0xff];
+        }
+    }
+};
+
+quint32 crc32cSoftware(quint32 crc, const uchar *p, qint64 len)
+{
+    static const Tables tables;
+    const auto &t = tables.t;
+    while (len >= 8) {
+        quint32 low;
+        quint32 high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low = qFromLittleEndian(low) ^ crc;
+        high = qFromLittleEndian(high);
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+              ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(IDM_CRC32C_SSE42)
+__attribute__((target("sse4.2"))) quint32 crc32cHardware(quint32 crc, const uchar *p, qint64 len)
+{
+    quint64 crc64 = crc;
+    while (len >= 8) {
+        quint64 word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<quint32>(crc64);
+    while (len-- > 0) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+bool hasHardwareCrc()
+{
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#elif defined(IDM_CRC32C_ARM)
+quint32 crc32cHardware(quint32 crc, const uchar *p, qint64 len)
+{
+    while (len >= 8) {
+        quint64 word;
+        std::memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+bool hasHardwareCrc()
+{
+    return true;
+}
+#endif
+
+quint32 gf2MatrixTimes(const quint32 *matrix, quint32 vector)
+{
+    quint32 sum = 0;
+    for (; vector; vector >>= 1, ++matrix) {
+        if (vector & 1) sum ^= *matrix;
+    }
+    return sum;
+}
+
+void gf2MatrixSquare(quint32 *square, const quint32 *matrix)
+{
+    for (int n = 0; n < 32; ++n) square[n] = gf2MatrixTimes(matrix, matrix[n]);
+}
+}
+
+quint32 crc32cUpdate(quint32 crc, const char *data, qint64 len)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    crc = ~crc;
+#if defined(IDM_CRC32C_SSE42) || defined(IDM_CRC32C_ARM)
+    if (hasHardwareCrc()) return ~crc32cHardware(crc, p, len);
+#endif
+    return ~crc32cSoftware(crc, p, len);
+}
+
+/**
+ * @brief Same approach as zlib's crc32_combine(): applies lengthB zero bytes
+ * to crcA through repeated squaring of the CRC shift operator.
+ */
+quint32 crc32cCombine(quint32 crcA, quint32 crcB, qint64 lengthB)
+{
+    if (lengthB <= 0) return crcA;
+
+    quint32 even[32]; // Operator for an even power of two zero bits
+    quint32 odd[32];
+    odd[0] = kPolynomial;
+    quint32 row = 1;
+    for (int n = 1; n < 32; ++n) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2MatrixSquare(even, odd); // Two zero bits
+    gf2MatrixSquare(odd, even); // Four zero bits
+
+    do {
+        gf2MatrixSquare(even, odd);
+        if (lengthB & 1) crcA = gf2MatrixTimes(even, crcA);
+        lengthB >>= 1;
+        if (!lengthB) break;
+        gf2MatrixSquare(odd, even);
+        if (lengthB & 1) crcA = gf2MatrixTimes(odd, crcA);
+        lengthB >>= 1;
+    } while (lengthB);
+
+    return crcA ^ crcB;
+}
@@ -0,0 +1,14 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <QtGlobal>
+
+// CRC-32C (Castagnoli). Start with 0 and pass the previous result to continue.
+// Uses the SSE4.2 / ARMv8 CRC instructions when the CPU has them.
+quint32 crc32cUpdate(quint32 crc, const char *data, qint64 len);
+
+// CRC of A followed by B, from crc(A), crc(B) and the length of B. Lets
+// segments be checksummed independently and joined at the end.
+quint32 crc32cCombine(quint32 crcA, quint32 crcB, qint64 lengthB);
+
+#endif // CRC32C_H
@@ -0,0 +1,406 @@
+#include "diskwriter.h"
+#include "segmentfile.h"
+#include <QByteArrayView>
+#include <QDebug>
+#include <QFileInfo>
+#include <QStorageInfo>
+
+#ifdef IDM_HAVE_IO_URING
+#include <liburing.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+// Blocks allocated up front (and registered with io_uring when it is used)
+constexpr int kArenaBlocks = 16;
+// Extra blocks kept for reuse once the arena is handed out
+constexpr int kMaxFreeBlocks = 16;
+// Batches in flight at once on the io_uring path
+constexpr int kQueueDepth = 8;
+// Keeps blocks usable for O_DIRECT as well
+constexpr size_t kBlockAlignment = 4096;
+}
+
+/**
+ * @brief Staging memory of one writer: a fixed arena of kArenaBlocks blocks
+ * that never moves (io_uring pins it), plus heap blocks when that runs out.
+ */
+class DiskBufferPool
+{
+public:
+    DiskBufferPool()
+        : m_arena(static_cast<char *>(qMallocAligned(kArenaBlocks * DiskWriter::kBlockSize, kBlockAlignment)))
+    {
+        for (int slot = kArenaBlocks - 1; m_arena && slot >= 0; --slot) m_freeSlots.append(slot);
+    }
+
+    ~DiskBufferPool()
+    {
+        qFreeAligned(m_arena);
+        for (char *block : std::as_const(m_freeBlocks)) qFreeAligned(block);
+    }
+
+    char *arena() const { return m_arena; }
+
+    char *take(int *slot)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_freeSlots.isEmpty()) {
+            *slot = m_freeSlots.takeLast();
+            return m_arena + *slot * DiskWriter::kBlockSize;
+        }
+        *slot = -1;
+        if (!m_freeBlocks.isEmpty()) return m_freeBlocks.takeLast();
+        locker.unlock();
+        return static_cast<char *>(qMallocAligned(DiskWriter::kBlockSize, kBlockAlignment));
+    }
+
+    void giveBack(char *data, int slot)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (slot >= 0) {
+            m_freeSlots.append(slot);
+        } else if (m_freeBlocks.size() < kMaxFreeBlocks) {
+            m_freeBlocks.append(data);
+        } else {
+            locker.unlock();
+            qFreeAligned(data);
+        }
+    }
+
+private:
+    QMutex m_mutex;
+    char *m_arena;
+    QList<int> m_freeSlots;
+    QList<char*> m_freeBlocks;
+};
+
+DiskBuffer::Block::~Block()
+{
+    if (pool && data) pool->giveBack(data, slot);
+}
+
+#ifdef IDM_HAVE_IO_URING
+/**
+ * @brief io_uring submission of a group of batches. Only used from the writer
+ * thread; the arena is registered once so single-block writes skip the
+ * per-call page pinning.
+ */
+class DiskWriter::Uring
+{
+public:
+    static Uring *create(DiskBufferPool *buffers)
+    {
+        Uring *uring = new Uring;
+        int rc = io_uring_queue_init(kQueueDepth, &uring->m_ring, 0);
+        if (rc < 0) {
+            qWarning() << "io_uring unavailable:" << std::strerror(-rc) << "- using pwrite";
+            uring->m_ready = false;
+            delete uring;
+            return nullptr;
+        }
+        if (buffers->arena()) {
+            QList<iovec> blocks(kArenaBlocks);
+            for (int slot = 0; slot < kArenaBlocks; ++slot) {
+                blocks[slot].iov_base = buffers->arena() + slot * kBlockSize;
+                blocks[slot].iov_len = kBlockSize;
+            }
+            rc = io_uring_register_buffers(&uring->m_ring, blocks.constData(), blocks.size());
+            uring->m_fixedBuffers = rc == 0;
+            if (rc < 0) qWarning() << "io_uring: cannot register buffers:" << std::strerror(-rc);
+        }
+        return uring;
+    }
+
+    ~Uring()
+    {
+        if (m_ready) io_uring_queue_exit(&m_ring);
+    }
+
+    QList<Result> write(const QList<QList<Request>> &group)
+    {
+        QList<Result> results(group.size());
+        QList<QList<iovec>> vectors(group.size()); // Read by the kernel until completion
+        for (int i = 0; i < group.size(); ++i) {
+            const QList<Request> &batch = group[i];
+            const Request &first = batch.first();
+            const int fd = first.file->handle();
+            io_uring_sqe *sqe = io_uring_get_sqe(&m_ring); // group.size() <= kQueueDepth
+            if (first.sync) {
+                io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+                sqe->flags |= IOSQE_IO_DRAIN; // Waits for the writes submitted before it
+            } else if (batch.size() == 1 && m_fixedBuffers && first.data.slot() >= 0) {
+                io_uring_prep_write_fixed(sqe, fd, first.data.constData(), static_cast<unsigned>(first.data.size()),
+                                          static_cast<__u64>(first.offset), first.data.slot());
+            } else {
+                QList<iovec> &iov = vectors[i];
+                for (const Request &request : batch) {
+                    iov.append(iovec{const_cast<char *>(request.data.constData()), static_cast<size_t>(request.data.size())});
+                }
+                io_uring_prep_writev(sqe, fd, iov.constData(), static_cast<unsigned>(iov.size()),
+                                     static_cast<__u64>(first.offset));
+            }
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<quintptr>(i)));
+        }
+
+        int rc;
+        do {
+            rc = io_uring_submit_and_wait(&m_ring, static_cast<unsigned>(group.size()));
+        } while (rc == -EINTR);
+        if (rc < 0) {
+            // The SQEs are already in the shared ring and a later submit would send them
+            // with freed iovecs and reused blocks: give the ring up, then write portably
+            qWarning() << "io_uring: submit failed:" << std::strerror(-rc) << "- using pwrite";
+            m_broken = true;
+            for (int i = 0; i < group.size(); ++i) results[i] = writeBatch(group[i]);
+            return results;
+        }
+
+        QList<bool> completed(group.size(), false);
+        for (int done = 0; done < group.size(); ++done) {
+            io_uring_cqe *cqe = nullptr;
+            do {
+                rc = io_uring_wait_cqe(&m_ring, &cqe);
+            } while (rc == -EINTR);
+            if (rc < 0) {
+                // What is still in flight can no longer be collected: those batches are
+                // written again below and the ring is given up (see isBroken())
+                qWarning() << "io_uring: waiting for completions failed:" << std::strerror(-rc) << "- using pwrite";
+                m_broken = true;
+                break;
+            }
+            const int i = static_cast<int>(reinterpret_cast<quintptr>(io_uring_cqe_get_data(cqe)));
+            const int res = cqe->res;
+            io_uring_cqe_seen(&m_ring, cqe);
+            results[i] = res < 0 ? Result{-1, QString::fromLocal8Bit(std::strerror(-res))} : Result{res, QString()};
+            completed[i] = true;
+        }
+        for (int i = 0; i < group.size(); ++i) {
+            if (!completed[i]) results[i] = writeBatch(group[i]); // Same bytes at the same offsets
+        }
+
+        // Short writes are finished the portable way
+        for (int i = 0; i < group.size(); ++i) {
+            if (group[i].first().sync || results[i].written < 0) continue;
+            qint64 total = 0;
+            for (const Request &request : group[i]) total += request.data.size();
+            if (results[i].written < total) {
+                Result rest = writeBatch(group[i], results[i].written);
+                results[i] = rest.written < 0 ? rest : Result{total, QString()};
+            }
+        }
+        return results;
+    }
+
+    // A submit or the completions failed; the ring must not be used again
+    bool isBroken() const { return m_broken; }
+
+private:
+    io_uring m_ring;
+    bool m_ready = true;
+    bool m_fixedBuffers = false;
+    bool m_broken = false;
+};
+#endif
+
+DiskWriter::DiskWriter(const QString &name, QObject *parent)
+    : QThread(parent), m_buffers(new DiskBufferPool)
+{
+    setObjectName(name.isEmpty() ? QStringLiteral("DiskWriter") : "DiskWriter-" + name);
+}
+
+DiskWriter::~DiskWriter()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+    wait();
+}
+
+/**
+ * @brief An empty kBlockSize buffer, from the arena while it lasts.
+ */
+DiskBuffer DiskWriter::takeBuffer()
+{
+    DiskBuffer buffer;
+    buffer.m_block.reset(new DiskBuffer::Block);
+    buffer.m_block->pool = m_buffers;
+    buffer.m_block->data = m_buffers->take(&buffer.m_block->slot);
+    return buffer;
+}
+
+void DiskWriter::submit(QObject *owner, SegmentFile *file, int tag, qint64 offset, DiskBuffer data)
+{
+    if (data.isEmpty()) return;
+    enqueue(Request{owner, file, tag, offset, std::move(data), false});
+}
+
+void DiskWriter::submitSync(QObject *owner, SegmentFile *file, int tag)
+{
+    enqueue(Request{owner, file, tag, 0, DiskBuffer(), true});
+}
+
+void DiskWriter::enqueue(Request request)
+{
+    QMutexLocker locker(&m_mutex);
+    ++m_inFlight[request.owner];
+    m_queue.append(std::move(request));
+    if (!isRunning()) start();
+    m_wake.wakeOne();
+}
+
+QList<DiskWriter::Completion> DiskWriter::takeCompleted(QObject *owner)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_completed.take(owner);
+}
+
+void DiskWriter::waitForOwner(QObject *owner)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_inFlight.value(owner) > 0) m_idle.wait(&m_mutex);
+}
+
+void DiskWriter::detach(QObject *owner)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_inFlight.value(owner) > 0) m_idle.wait(&m_mutex);
+    m_inFlight.remove(owner);
+    m_completed.remove(owner);
+}
+
+/**
+ * @brief Takes the oldest request plus every queued one that continues it in
+ * the same file, up to kMaxWriteSize. Called with m_mutex held.
+ */
+QList<DiskWriter::Request> DiskWriter::takeBatch()
+{
+    QList<Request> batch;
+    batch.append(m_queue.takeFirst());
+    if (batch.first().sync) return batch;
+    qint64 size = batch.first().data.size();
+    for (int i = 0; i < m_queue.size();) {
+        const Request &last = batch.last();
+        const Request &next = m_queue.at(i);
+        if (!next.sync && next.file == last.file && next.offset == last.offset + last.data.size()
+            && size + next.data.size() <= kMaxWriteSize) {
+            size += next.data.size();
+            batch.append(m_queue.takeAt(i));
+            i = 0; // The one after it may be queued earlier
+        } else {
+            ++i;
+        }
+    }
+    return batch;
+}
+
+/**
+ * @brief Writes (or syncs) one batch with plain positional writes, leaving
+ * out the first skip bytes.
+ */
+DiskWriter::Result DiskWriter::writeBatch(const QList<Request> &batch, qint64 skip)
+{
+    SegmentFile *file = batch.first().file;
+    if (batch.first().sync) {
+        if (file->sync()) return Result{0, QString()};
+        return Result{-1, file->errorString()};
+    }
+
+    const qint64 start = batch.first().offset + skip;
+    QList<QByteArrayView> parts;
+    qint64 total = 0;
+    for (const Request &request : batch) {
+        total += request.data.size();
+        const qint64 from = qMin(skip, request.data.size());
+        skip -= from;
+        if (from < request.data.size()) parts.append(QByteArrayView(request.data.constData() + from, request.data.size() - from));
+    }
+    if (file->writeAt(start, parts) < 0) return Result{-1, file->errorString()};
+    return Result{total, QString()};
+}
+
+QList<DiskWriter::Result> DiskWriter::writeGroup(const QList<QList<Request>> &group)
+{
+#ifdef IDM_HAVE_IO_URING
+    if (m_uring) {
+        QList<Result> results = m_uring->write(group);
+        if (m_uring->isBroken()) {
+            delete m_uring; // pwrite from here on
+            m_uring = nullptr;
+        }
+        return results;
+    }
+#endif
+    QList<Result> results;
+    for (const QList<Request> &batch : group) results.append(writeBatch(batch));
+    return results;
+}
+
+void DiskWriter::run()
+{
+#ifdef IDM_HAVE_IO_URING
+    m_uring = Uring::create(m_buffers.data());
+    if (m_uring) qDebug() << objectName() << "writes through io_uring";
+#endif
+
+    QMutexLocker locker(&m_mutex);
+    forever {
+        while (m_queue.isEmpty() && !m_quit) m_wake.wait(&m_mutex);
+        if (m_queue.isEmpty()) break;
+
+        const int depth = m_uring ? kQueueDepth : 1; // The ring can be given up on the way
+        QList<QList<Request>> group;
+        while (!m_queue.isEmpty() && group.size() < depth) group.append(takeBatch());
+        locker.unlock();
+        const QList<Result> results = writeGroup(group);
+        for (int i = 0; i < group.size(); ++i) {
+            const Request &first = group[i].first();
+            if (!first.sync && results[i].written > 0) first.file->noteWritten(first.offset, results[i].written);
+        }
+        locker.relock();
+
+        for (int i = 0; i < group.size(); ++i) {
+            const Result &result = results[i];
+            if (result.written < 0) {
+                qCritical() << objectName() << "write to" << group[i].first().file->fileName() << "failed:" << result.error;
+            }
+            for (const Request &request : group[i]) {
+                QList<Completion> &done = m_completed[request.owner];
+                // Posted under the lock: detach() cannot return in between, so the owner is alive
+                if (done.isEmpty()) QMetaObject::invokeMethod(request.owner, "onWritesCompleted", Qt::QueuedConnection);
+                done.append(Completion{request.tag, request.offset, request.data.size(), result.written >= 0, result.error});
+                --m_inFlight[request.owner];
+            }
+        }
+        group.clear(); // Blocks go back to the pool here
+        m_idle.wakeAll();
+    }
+    locker.unlock();
+
+#ifdef IDM_HAVE_IO_URING
+    delete m_uring;
+    m_uring = nullptr;
+#endif
+}
+
+DiskWriterPool::~DiskWriterPool()
+{
+    qDeleteAll(m_writers);
+}
+
+DiskWriter *DiskWriterPool::writerFor(const QString &filePath)
+{
+    QStorageInfo storage(QFileInfo(filePath).absolutePath());
+    const QByteArray device = storage.isValid() ? storage.device() : QByteArray();
+
+    QMutexLocker locker(&m_mutex);
+    DiskWriter *&writer = m_writers[device];
+    if (!writer) {
+        writer = new DiskWriter(QString::number(m_writers.size()));
+        qDebug() << "Disk writer" << writer->objectName() << "for volume" << (device.isEmpty() ? "(unknown)" : device);
+    }
+    return writer;
+}
@@ -0,0 +1,140 @@
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+class SegmentFile;
+class DiskBufferPool;
+
+/**
+ * @brief One block of staging memory from a DiskWriter. Copies share the
+ * block (there is no copy-on-write); it goes back to its pool once the last
+ * copy is gone, even if that is after the writer.
+ */
+class DiskBuffer
+{
+public:
+    DiskBuffer() = default;
+
+    bool isEmpty() const { return m_size == 0; }
+    qint64 size() const { return m_size; }
+    void resize(qint64 size) { m_size = size; } // Up to DiskWriter::kBlockSize
+    char *data() { return m_block ? m_block->data : nullptr; }
+    const char *constData() const { return m_block ? m_block->data : nullptr; }
+    int slot() const { return m_block ? m_block->slot : -1; } // Registered block index, -1 if none
+
+private:
+    friend class DiskWriter;
+    struct Block {
+        ~Block();
+        QSharedPointer<DiskBufferPool> pool;
+        char *data = nullptr;
+        int slot = -1;
+    };
+    QSharedPointer<Block> m_block;
+    qint64 m_size = 0;
+};
+
+/**
+ * @brief Write-behind thread for one volume.
+ *
+ * Downloads fill block-sized buffers taken from takeBuffer() and hand them
+ * over with submit(). The thread merges queued buffers that continue each
+ * other in the same file into one positional write of up to kMaxWriteSize,
+ * then recycles the buffers. Finished writes are collected per owner: the
+ * owner's onWritesCompleted() slot is invoked and it picks them up with
+ * takeCompleted().
+ *
+ * Built with IDM_ENABLE_IO_URING, writes and syncs go through an io_uring
+ * with the pool's blocks registered as fixed buffers; if the kernel refuses
+ * the ring, the portable pwrite path is used.
+ */
+class DiskWriter : public QThread
+{
+    Q_OBJECT
+public:
+    // Downloads flush at multiples of this offset, so writes stay block aligned
+    static constexpr qint64 kBlockSize = 1024 * 1024;
+    static constexpr qint64 kMaxWriteSize = 4 * 1024 * 1024;
+
+    struct Completion {
+        int tag = 0;          // Caller's label, e.g. the segment index
+        qint64 offset = 0;
+        qint64 bytes = 0;     // Size of the submitted buffer, 0 for a sync
+        bool ok = true;
+        QString error;
+    };
+
+    explicit DiskWriter(const QString &name = QString(), QObject *parent = nullptr);
+    ~DiskWriter();
+
+    // Thread-safe
+    DiskBuffer takeBuffer();
+    void submit(QObject *owner, SegmentFile *file, int tag, qint64 offset, DiskBuffer data);
+    // Flushes file to stable storage once the writes queued before it are done
+    void submitSync(QObject *owner, SegmentFile *file, int tag);
+    QList<Completion> takeCompleted(QObject *owner);
+    void waitForOwner(QObject *owner);
+    // Blocks until everything owner submitted is written; it gets no more calls
+    void detach(QObject *owner);
+
+protected:
+    void run() override;
+
+private:
+    struct Request {
+        QObject *owner = nullptr;
+        SegmentFile *file = nullptr;
+        int tag = 0;
+        qint64 offset = 0;
+        DiskBuffer data;
+        bool sync = false;
+    };
+    struct Result {
+        qint64 written = 0; // -1 on error
+        QString error;
+    };
+    class Uring;
+
+    void enqueue(Request request);
+    QList<Request> takeBatch();
+    static Result writeBatch(const QList<Request> &batch, qint64 skip = 0);
+    QList<Result> writeGroup(const QList<QList<Request>> &group);
+
+    QSharedPointer<DiskBufferPool> m_buffers;
+    Uring *m_uring = nullptr; // Only touched by the writer thread
+    QMutex m_mutex;
+    QWaitCondition m_wake;  // Work queued or quitting
+    QWaitCondition m_idle;  // A batch finished
+    QList<Request> m_queue;
+    QHash<QObject*, int> m_inFlight;
+    QHash<QObject*, QList<Completion>> m_completed;
+    bool m_quit = false;
+};
+
+/**
+ * @brief One DiskWriter per volume, so a slow disk does not hold up
+ * downloads going to another one.
+ */
+class DiskWriterPool
+{
+public:
+    DiskWriterPool() = default;
+    ~DiskWriterPool();
+
+    DiskWriter *writerFor(const QString &filePath);
+
+private:
+    QMutex m_mutex;
+    QHash<QByteArray, DiskWriter*> m_writers; // By device
+};
+
+#endif // DISKWRITER_H
@@ -1,24 +1,126 @@
 #include "downloaditem.h"
+#include "chunkmerger.h"
+#include "connectionpool.h"
+#include "nativehttpclient.h"
+#include "ratelimiter.h"
+#include "memorybudget.h"
+#include "diskwriter.h"
 #include <QNetworkRequest>
+#include <QHttp2Configuration>
 #include <QFileInfo>
 #include <QDir>
 #include <QDebug>
 #include <QThread>
+#include <QtEndian>
+#include <QTimer>
+#include <QRandomGenerator>
 #include <algorithm>
+#include <numeric>
+#include "crc32c.h"
+#include "../utils/utils.h"
+
+namespace {
+// Ranges with less than twice this left are not worth a new connection
+constexpr qint64 kMinSplitSize = 512 * 1024;
+// End game: a request expected to need longer than this gets a hedge, once it
+// has run for kHedgeMinAgeMs; the first of the two to add kHedgeDecisionBytes wins
+constexpr double kHedgeMinSecondsLeft = 3.0;
+constexpr qint64 kHedgeMinAgeMs = 2000;
+constexpr qint64 kHedgeDecisionBytes = 64 * 1024;
+// Sequential mode cuts the file into about kStreamPieces pieces, each within
+// these bounds, so connections stay close to what the player needs next
+constexpr qint64 kStreamPieces = 256;
+constexpr qint64 kStreamPieceMin = 4 * 1024 * 1024;
+constexpr qint64 kStreamPieceMax = 64 * 1024 * 1024;
+// Bounds for setProgressRate(), in publications per second
+constexpr int kMaxProgressRate = 60;
+// HTTP/2 flow-control windows. Qt's defaults are small enough that one stream
+// per segment stalls on WINDOW_UPDATE round trips on high-latency links.
+constexpr qint32 kHttp2StreamWindow = 4 * 1024 * 1024;
+constexpr qint32 kHttp2SessionWindow = 32 * 1024 * 1024;
+// Read buffer for replies of items that have no shared memory budget
+constexpr qint64 kDefaultReadBuffer = 1024 * 1024;
+// Hashing reads data back in pieces of this size, and at most kHashCatchUpBudget
+// per event so the item's thread keeps serving its sockets
+constexpr qint64 kHashReadSize = 1024 * 1024;
+constexpr qint64 kHashCatchUpBudget = 16 * 1024 * 1024;
+// Retry backoff: doubles from kRetryBaseMs up to kRetryMaxMs, with jitter so
+// segments that failed together do not come back together. A Retry-After
+// longer than kRetryAfterMaxMs is cut short.
+constexpr qint64 kRetryBaseMs = 1000;
+constexpr qint64 kRetryMaxMs = 60000;
+constexpr qint64 kRetryAfterMaxMs = 5 * 60000;
+
+// "bytes first-last/total"; total is -1 when given as "*"
+bool parseContentRange(const QByteArray &value, qint64 *first, qint64 *total)
+{
+    const QByteArray range = value.trimmed();
+    if (!range.startsWith("bytes ")) return false;
+    const qsizetype dash = range.indexOf('-');
+    const qsizetype slash = range.indexOf('/');
+    if (dash < 0 || slash < dash) return false;
+    bool ok = false;
+    *first = range.mid(6, dash - 6).trimmed().toLongLong(&ok);
+    if (!ok) return false;
+    const QByteArray length = range.mid(slash + 1).trimmed();
+    *total = length == "*" ? -1 : length.toLongLong(&ok);
+    return ok;
+}
+
+// Errors another attempt may not hit: server trouble, throttling, dropped or
+// timed-out connections. Other client errors, TLS and protocol errors are fatal.
+bool isRetryable(const QNetworkReply *reply)
+{
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status >= 500 || status == 408 || status == 429) return true;
+    if (status >= 400) return false;
+    switch (reply->error()) {
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::UnknownNetworkError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::InternalServerError:
+    case QNetworkReply::ServiceUnavailableError:
+    case QNetworkReply::UnknownServerError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Retry-After as delta-seconds or an HTTP date; -1 when absent
+qint64 retryAfterMs(const QNetworkReply *reply)
+{
+    const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty()) return -1;
+    bool ok = false;
+    const qint64 seconds = value.toLongLong(&ok);
+    if (ok) return qMax<qint64>(0, seconds) * 1000;
+    const QDateTime date = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+    return date.isValid() ? qMax<qint64>(0, QDateTime::currentDateTimeUtc().msecsTo(date)) : -1;
+}
+
+qint64 retryDelay(int attempt, qint64 retryAfter)
+{
+    if (retryAfter >= 0) return qMin(retryAfter, kRetryAfterMaxMs);
+    const qint64 ceiling = qMin(kRetryMaxMs, kRetryBaseMs << qMin(attempt, 6));
+    return ceiling / 2 + QRandomGenerator::global()->bounded(int(ceiling / 2) + 1);
+}
+}
 
 DownloadItem::DownloadItem(const QUrl &url, const QString &filePath, QObject *parent)
     : QObject(parent), m_url(url), m_fullFilePath(filePath), m_totalSize(-1), m_downloadedSize(0),
-    m_state(Queued), m_reply(nullptr), m_manager(new QNetworkAccessManager(this)), m_transferRate(0),
-    m_speedLimit(0), m_bytesReadThisSecond(0), m_numChunks(1), m_supportsRange(true), m_file(nullptr),
-    m_isSingleChunk(false), m_lastUpdateTime(QDateTime::currentMSecsSinceEpoch()), m_chunkProgress(nullptr)
+    m_state(Queued), m_reply(nullptr), m_manager(nullptr), m_transferRate(0),
+    m_speedLimit(0), m_numChunks(1), m_supportsRange(true), m_file(nullptr),
+    m_isSingleChunk(false), m_lastUpdateTime(QDateTime::currentMSecsSinceEpoch())
 {
-    m_chunkProgress = new qint64[1]; // Allocate array
-    m_chunkProgress[0] = 0;
-    m_speedLimitTimer.start();
-    m_rateTimer = new QTimer(this);
-    connect(m_rateTimer, &QTimer::timeout, this, &DownloadItem::updateTransferRate);
-    m_rateTimer->start(1000); // Update rate every second
-
+    // Timers and network objects are created once the item starts (acquireRuntime()),
+    // so the thousands of inactive items loaded from history stay plain records
+    m_clock.start();
     QString fileName = QFileInfo(filePath).fileName();
     if (fileName.isEmpty()) {
         fileName = "download_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
@@ -28,25 +130,19 @@ DownloadItem::DownloadItem(const QUrl &url, const QString &filePath, QObject *pa
 
 /**
  * Destructor for the DownloadItem class.
- * Stops any ongoing download, terminates the worker thread, and cleans up resources.
+ * Stops any ongoing download, stops the merge thread, and cleans up resources.
  */
 DownloadItem::~DownloadItem()
 {
     stop();
-    if (m_workerThread) {
-        m_workerThread->quit(); // Request thread to stop
-        if (!m_workerThread->wait(5000)) { // Wait up to 5 seconds
-            qWarning() << "Worker thread did not stop for" << m_fileName << ", forcing termination";
-            m_workerThread->terminate();
-            m_workerThread->wait();
-        }
-        delete m_workerThread;
-        m_workerThread = nullptr;
-    }
-    delete m_worker;
-    m_worker = nullptr;
+    stopMergeThread();
+    if (m_writer) m_writer->detach(this);
+    delete m_ownWriter;
+    delete m_hasher;
+    if (m_limiter) m_limiter->removeItem(this);
+    if (m_budget) m_budget->removeOwner(this);
+    releaseNetworkManager();
     delete m_manager; // Direct deletion to ensure cleanup
-    delete[] m_chunkProgress;
 }
 
 /**
@@ -58,32 +154,151 @@ QNetworkRequest DownloadItem::createNetworkRequest(const QUrl &url)
     request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
     request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
     request.setHeader(QNetworkRequest::UserAgentHeader, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) Chrome/91.0.4472.124 Safari/537.36 Edg/91.0.864.59");
+    if (m_transport == Http2) {
+        request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+        QHttp2Configuration http2;
+        http2.setStreamReceiveWindowSize(kHttp2StreamWindow);
+        http2.setSessionReceiveWindowSize(kHttp2SessionWindow);
+        request.setHttp2Configuration(http2);
+    }
     return request;
 }
 
+/**
+ * @brief The manager requests go through: borrowed from the shared pool while
+ * downloading so connections to the host are reused across items, or the
+ * item's own one when no pool was set.
+ */
+QNetworkAccessManager *DownloadItem::networkManager()
+{
+    if (m_pool) {
+        if (!m_sharedManager) m_sharedManager = m_pool->acquire(m_url, m_proxy);
+        return m_sharedManager;
+    }
+    if (!m_manager) {
+        m_manager = new QNetworkAccessManager(this);
+        m_manager->setProxy(m_proxy);
+    }
+    return m_manager;
+}
+
+NativeHttpClient *DownloadItem::nativeClient()
+{
+    if (m_pool) {
+        if (!m_sharedNativeClient) m_sharedNativeClient = m_pool->acquireNativeClient(m_url, m_proxy);
+        return m_sharedNativeClient;
+    }
+    if (!m_nativeClient) m_nativeClient = new NativeHttpClient(this);
+    m_nativeClient->setProxy(m_proxy);
+    return m_nativeClient;
+}
+
+void DownloadItem::releaseNetworkManager()
+{
+    if (m_sharedManager) {
+        m_pool->release(m_sharedManager);
+        m_sharedManager = nullptr;
+    }
+    if (m_sharedNativeClient) {
+        m_pool->release(m_sharedNativeClient);
+        m_sharedNativeClient = nullptr;
+    }
+}
+
+/**
+ * @brief Sends a request over the item's transport. Both return a
+ * QNetworkReply, so everything downstream is transport agnostic.
+ */
+QNetworkReply *DownloadItem::sendGet(const QNetworkRequest &request)
+{
+    const QString scheme = request.url().scheme();
+    if (m_transport == NativeHttp && (scheme == "http" || scheme == "https")) return nativeClient()->get(request);
+    return networkManager()->get(request);
+}
+
+QNetworkReply *DownloadItem::sendHead(const QNetworkRequest &request)
+{
+    const QString scheme = request.url().scheme();
+    if (m_transport == NativeHttp && (scheme == "http" || scheme == "https")) return nativeClient()->head(request);
+    return networkManager()->head(request);
+}
+
+void DownloadItem::setConnectionPool(ConnectionPool *pool)
+{
+    if (runInOwnThread([this, pool]() { setConnectionPool(pool); })) return;
+    if (pool == m_pool) return;
+    releaseNetworkManager();
+    m_pool = pool;
+}
+
 /**
  * @brief Sets the state of the DownloadItem and emits a stateChanged signal if the state changes.
  */
 void DownloadItem::setState(State state)
 {
+    if (runInOwnThread([this, state]() { setState(state); })) return;
     if (m_state != state) {
         m_state = state;
-        emit stateChanged(m_state);
+        // Nothing in flight any more: hand the shared manager back so it can idle out
+        if (m_state != Downloading) {
+            releaseNetworkManager();
+            releaseRuntime();
+        }
+        emit stateChanged(state);
     }
 }
+
+// Settings the running transfer reads; applied on the item's thread like setProxy()
+void DownloadItem::setWriteMode(WriteMode mode)
+{
+    if (runInOwnThread([this, mode]() { setWriteMode(mode); })) return;
+    m_writeMode = mode;
+}
+
+void DownloadItem::setChunkDirectory(const QString &dir)
+{
+    if (runInOwnThread([this, dir]() { setChunkDirectory(dir); })) return;
+    m_chunkDirectory = dir;
+}
+
+void DownloadItem::setMaxConnections(int max)
+{
+    if (runInOwnThread([this, max]() { setMaxConnections(max); })) return;
+    m_connections.setMaximum(max);
+}
+
+void DownloadItem::setTransport(Transport transport, bool chosen)
+{
+    if (runInOwnThread([this, transport, chosen]() { setTransport(transport, chosen); })) return;
+    m_transport = transport;
+    m_transportChosen = chosen;
+}
+
+void DownloadItem::setFastStart(bool enabled)
+{
+    if (runInOwnThread([this, enabled]() { setFastStart(enabled); })) return;
+    m_fastStart = enabled;
+}
+
+void DownloadItem::setStallTimeout(int seconds)
+{
+    if (runInOwnThread([this, seconds]() { setStallTimeout(seconds); })) return;
+    m_stallTimeoutMs = qMax(1, seconds) * 1000;
+}
+
+void DownloadItem::setMaxRetries(int retries)
+{
+    if (runInOwnThread([this, retries]() { setMaxRetries(retries); })) return;
+    m_maxRetries = qMax(0, retries);
+}
+
+void DownloadItem::setLargeFileMode(bool enabled)
+{
+    if (runInOwnThread([this, enabled]() { setLargeFileMode(enabled); })) return;
+    m_largeFileMode = enabled;
+}
 void DownloadItem::setNumChunks(int numChunks) {
-    if (numChunks < 1) numChunks = 1;
-    if (numChunks == m_numChunks) return;
-    delete[] m_chunkProgress;
-    m_numChunks = numChunks;
-    m_chunkProgress = new qint64[numChunks]();
-    // Distribute downloadedSize across chunks if needed
-    if (m_downloadedSize > 0 && m_totalSize > 0) {
-        qint64 perChunk = m_downloadedSize / numChunks;
-        for (int i = 0; i < numChunks; ++i) {
-            m_chunkProgress[i] = (i == numChunks - 1) ? (m_downloadedSize - (perChunk * (numChunks - 1))) : perChunk;
-        }
-    }
+    m_numChunks = qMax(1, numChunks);
 }
 
 /**
@@ -91,6 +306,8 @@ void DownloadItem::setNumChunks(int numChunks) {
  */
 void DownloadItem::setProxy(const QNetworkProxy &proxy)
 {
+    if (runInOwnThread([this, proxy]() { setProxy(proxy); })) return;
+    m_proxy = proxy; // A borrowed manager is picked by proxy on the next acquire
     if (m_manager) m_manager->setProxy(proxy);
 }
 
@@ -99,274 +316,845 @@ void DownloadItem::setProxy(const QNetworkProxy &proxy)
  */
 void DownloadItem::setSpeedLimit(qint64 bytesPerSec)
 {
+    if (runInOwnThread([this, bytesPerSec]() { setSpeedLimit(bytesPerSec); })) return;
     QMutexLocker locker(&m_speedLimitMutex);
     qDebug() << "Setting speed limit to" << bytesPerSec << "for" << m_fileName
-             << "(state:" << m_state << ", thread:" << QThread::currentThreadId() << ")";
+             << "(state:" << m_state.load() << ", thread:" << QThread::currentThreadId() << ")";
     if (m_state == Failed || m_state == Completed) {
-        qWarning() << "Ignoring speed limit change for" << m_fileName << "in state" << m_state;
+        qWarning() << "Ignoring speed limit change for" << m_fileName << "in state" << m_state.load();
         return;
     }
     m_speedLimit = bytesPerSec;
-    m_bytesReadThisSecond = 0;
-    m_speedLimitTimer.restart();
+    if (m_limiter) m_limiter->setItemRate(this, m_speedLimit);
+}
 
-    if (!m_worker) {
-        m_worker = new SpeedLimitWorker(this);
-        m_workerThread = new QThread(this);
-        m_worker->moveToThread(m_workerThread);
-        connect(m_workerThread, &QThread::started, m_worker, [this]() {
-            QMetaObject::invokeMethod(m_worker, "enforceLimit", Qt::QueuedConnection, Q_ARG(qint64, 0));
-        }, Qt::QueuedConnection);
-        m_workerThread->start();
-        qDebug() << "Worker thread started for" << m_fileName;
-    }
+void DownloadItem::setRateLimiter(RateLimiter *limiter)
+{
+    if (runInOwnThread([this, limiter]() { setRateLimiter(limiter); })) return;
+    if (limiter == m_limiter) return;
+    if (m_limiter) m_limiter->removeItem(this);
+    m_limiter = limiter;
+    QMutexLocker locker(&m_speedLimitMutex);
+    if (m_limiter && m_speedLimit > 0) m_limiter->setItemRate(this, m_speedLimit);
 }
 
-void DownloadItem::enforceSpeedLimit(qint64 bytesToRead)
+void DownloadItem::setMemoryBudget(MemoryBudget *budget)
 {
-    if (m_speedLimit <= 0 || !m_worker || !m_workerThread || !m_workerThread->isRunning()) {
-        qDebug() << "No speed limit or worker unavailable for" << m_fileName;
-        return;
-    }
+    if (runInOwnThread([this, budget]() { setMemoryBudget(budget); })) return;
+    if (m_budget && m_budget != budget) m_budget->removeOwner(this);
+    m_budget = budget;
+}
 
-    QMutexLocker locker(&m_speedLimitMutex);
-    qint64 elapsed = m_speedLimitTimer.elapsed();
-    m_bytesReadThisSecond += bytesToRead;
+void DownloadItem::setDiskWriterPool(DiskWriterPool *pool)
+{
+    if (runInOwnThread([this, pool]() { setDiskWriterPool(pool); })) return;
+    m_diskWriters = pool; // Picked up the next time files are opened
+}
+
+void DownloadItem::setExpectedChecksum(const Checksum &checksum)
+{
+    if (runInOwnThread([this, checksum]() { setExpectedChecksum(checksum); })) return;
+    QMutexLocker locker(&m_snapshotMutex);
+    m_expectedChecksum = checksum;
+}
+
+void DownloadItem::setChecksumUrl(const QUrl &url)
+{
+    if (runInOwnThread([this, url]() { setChecksumUrl(url); })) return;
+    m_checksumUrl = url;
+}
+
+void DownloadItem::setSequential(bool enabled)
+{
+    if (runInOwnThread([this, enabled]() { setSequential(enabled); })) return;
+    if (m_sequential == enabled) return;
+    m_sequential = enabled;
+    if (enabled && m_state == Downloading && !m_isSingleChunk && !m_segments.isEmpty()) cutIntoPieces();
+}
 
-    if (elapsed >= 1000) {
-        m_bytesReadThisSecond = 0; // Reset fully at second boundary
-        m_speedLimitTimer.restart();
-    } else if (m_bytesReadThisSecond > m_speedLimit) {
-        qint64 excess = m_bytesReadThisSecond - m_speedLimit;
-        qint64 sleepTime = (excess * 1000) / qMax<qint64>(1, m_speedLimit);
-        if (sleepTime > 0) {
-            qDebug() << "Throttling" << m_fileName << "sleeping for" << sleepTime << "ms, excess:" << excess;
-            QThread::msleep(static_cast<quint64>(sleepTime));
-            m_bytesReadThisSecond = bytesToRead; // Reset to current read after sleep
+/**
+ * @brief A player read (or seeked) at offset. The first missing piece from
+ * there should not queue behind ranges it does not need yet, so when every
+ * connection is busy the one working furthest from it gives way.
+ */
+void DownloadItem::setStreamPosition(qint64 offset)
+{
+    if (runInOwnThread([this, offset]() { setStreamPosition(offset); })) return;
+    if (m_streamPosition == offset) return;
+    m_streamPosition = offset;
+    if (m_state != Downloading || !m_sequential || m_isSingleChunk) return;
+
+    int wanted = -1;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        const Segment &segment = m_segments[i];
+        if (segment.reply || segment.remaining() <= 0 || segment.end <= offset) continue;
+        if (wanted < 0 || segment.start < m_segments[wanted].start) wanted = i;
+    }
+    if (wanted < 0) return;
+    if (activeSegmentCount() >= m_numChunks) {
+        const auto rank = [this](const Segment &s) { return std::make_pair(streamTier(s.start, s.end), s.start); };
+        int victim = -1;
+        for (int i = 0; i < m_segments.size(); ++i) {
+            const Segment &segment = m_segments[i];
+            if (!segment.reply || segment.hedge || rank(segment) <= rank(m_segments[wanted])) continue;
+            if (victim < 0 || rank(segment) > rank(m_segments[victim])) victim = i;
         }
+        if (victim < 0) return;
+        qDebug() << "Stream of" << m_fileName << "moved to" << offset << ", chunk" << victim << "gives way";
+        releaseSegment(victim);
     }
+    startSegments();
+}
 
-    QMetaObject::invokeMethod(m_worker, "enforceLimit", Qt::QueuedConnection, Q_ARG(qint64, bytesToRead));
+void DownloadItem::setMirrors(const QList<QUrl> &urls)
+{
+    if (runInOwnThread([this, urls]() { setMirrors(urls); })) return;
+    QMutexLocker locker(&m_snapshotMutex);
+    m_mirrorUrls = urls;
 }
 
-SpeedLimitWorker::SpeedLimitWorker(DownloadItem* parent) : m_parent(parent), m_timer(new QElapsedTimer())
+QList<QUrl> DownloadItem::getMirrors() const
 {
-    m_timer->start();
-    if (m_parent) {
-        qDebug() << "SpeedLimitWorker created for" << m_parent->m_fileName << "in thread" << QThread::currentThreadId();
-    } else {
-        qDebug() << "SpeedLimitWorker created with null parent in thread" << QThread::currentThreadId();
-    }
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_mirrorUrls;
 }
 
-SpeedLimitWorker::~SpeedLimitWorker()
+Checksum DownloadItem::getExpectedChecksum() const
 {
-    delete m_timer;
-    if (m_parent) {
-        qDebug() << "SpeedLimitWorker destroyed for" << m_parent->m_fileName;
-    } else {
-        qDebug() << "SpeedLimitWorker destroyed with null parent";
-    }
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_expectedChecksum;
 }
 
-void SpeedLimitWorker::enforceLimit(qint64 bytesToRead)
+Checksum DownloadItem::getActualChecksum() const
 {
-    if (!m_parent || m_parent->m_speedLimit <= 0) {
-        qDebug() << "No speed limit or parent invalid for" << (m_parent ? m_parent->m_fileName : "unknown");
-        return;
-    }
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_actualChecksum;
+}
 
-    QMutexLocker locker(&m_parent->m_speedLimitMutex);
-    qint64 elapsed = m_timer->elapsed();
-    qint64 totalBytes = m_parent->m_bytesReadThisSecond + bytesToRead;
+/**
+ * @brief Bounds a new reply's read buffer, so data nobody reads stays in the
+ * kernel (and TCP pushes back) instead of piling up inside the reply.
+ */
+void DownloadItem::configureReply(QNetworkReply *reply)
+{
+    reply->setReadBufferSize(m_budget ? m_budget->trackReply(reply) : kDefaultReadBuffer);
+}
 
-    qDebug() << "Enforcing limit: elapsed=" << elapsed << ", bytesToRead=" << bytesToRead
-             << ", bytesReadThisSecond=" << m_parent->m_bytesReadThisSecond << ", totalBytes=" << totalBytes;
+/**
+ * @brief How much of wanted may be read from reply right now. The bytes are
+ * taken from the memory budget and the rate limiter; hand the reservation back
+ * with finishRead() once the data is written. While rate limited the reply
+ * keeps only a small read buffer, so its socket fills up and TCP flow control
+ * slows the sender.
+ */
+qint64 DownloadItem::reserveRead(QNetworkReply *reply, qint64 wanted, const QString &host)
+{
+    qint64 bufferSize = m_limiter ? m_limiter->readBufferSizeFor(this, host) : 0;
+    if (bufferSize <= 0) bufferSize = m_budget ? m_budget->replyBufferSize() : kDefaultReadBuffer;
+    if (reply->readBufferSize() != bufferSize) reply->setReadBufferSize(bufferSize);
+
+    qint64 granted = m_budget ? m_budget->acquire(this, wanted) : wanted;
+    if (granted <= 0 || !m_limiter) return granted;
+    qint64 allowed = m_limiter->acquire(this, host, granted);
+    if (m_budget) m_budget->release(granted - allowed);
+    return allowed;
+}
 
-    if (elapsed >= 1000) {
-        m_parent->m_bytesReadThisSecond = bytesToRead;
-        m_timer->restart();
-    } else if (totalBytes > m_parent->m_speedLimit) {
-        qint64 excess = totalBytes - m_parent->m_speedLimit;
-        qint64 sleepTime = (excess * 1000) / qMax<qint64>(1, m_parent->m_speedLimit);
-        if (sleepTime > 0) {
-            qDebug() << "Worker throttling" << m_parent->m_fileName << "sleeping for" << sleepTime << "ms";
-            QThread::msleep(static_cast<quint64>(sleepTime));
-            m_parent->m_bytesReadThisSecond = bytesToRead;
-        }
+void DownloadItem::finishRead(qint64 reserved)
+{
+    if (m_budget) m_budget->release(reserved);
+}
+
+/**
+ * @brief Writer for the volume the segment files live on: from the shared pool,
+ * or the item's own thread when no pool was set.
+ */
+DiskWriter *DownloadItem::diskWriter()
+{
+    if (m_writer) return m_writer;
+    if (m_diskWriters) {
+        m_writer = m_diskWriters->writerFor(m_writeMode == ChunkFiles ? chunkFilePath(0) : m_fullFilePath);
     } else {
-        m_parent->m_bytesReadThisSecond = totalBytes;
+        if (!m_ownWriter) m_ownWriter = new DiskWriter(m_fileName);
+        m_writer = m_ownWriter;
     }
+    return m_writer;
 }
 
-// This will start download and file in the current queue, except for which is completed or Downloading
-void DownloadItem::start()
+/**
+ * @brief Hands the segment's staged block to the disk writer.
+ */
+void DownloadItem::flushSegment(int chunkIndex)
 {
-    if (m_state == Downloading || m_state == Completed) return;
+    Segment &segment = m_segments[chunkIndex];
+    if (segment.pending.isEmpty()) return;
+    SegmentFile *file = m_writeMode == DirectWrite ? m_outputFile : segment.file;
+    diskWriter()->submit(this, file, chunkIndex, segment.pendingOffset, std::move(segment.pending));
+    segment.pending = DiskBuffer();
+}
 
-    if (!m_url.isValid()) {
-        setState(Failed);
-        emit failed("Invalid URL provided");
-        return;
+/**
+ * @brief Applies the writes the disk writer has finished: their bytes count as
+ * written and their memory goes back to the budget.
+ * @return false if one failed, with the reason in error.
+ */
+bool DownloadItem::collectWrites(QString *error)
+{
+    if (!m_writer) return true;
+    bool ok = true;
+    QList<int> failedSegments;
+    for (const DiskWriter::Completion &done : m_writer->takeCompleted(this)) {
+        finishRead(done.bytes);
+        if (done.tag < 0 || done.tag >= m_segments.size() || failedSegments.contains(done.tag)) continue;
+        if (!done.ok) {
+            // Writes of a segment finish in order, so written stays a clean prefix
+            failedSegments.append(done.tag);
+            if (ok) *error = done.error;
+            ok = false;
+            continue;
+        }
+        m_segments[done.tag].written += done.bytes;
     }
+    return ok;
+}
 
-    QFileInfo fileInfo(m_fullFilePath);
-    QDir dir = fileInfo.absoluteDir();
-    setFullFilePath(m_fullFilePath);
-    qDebug () << "File Path"<<dir;
-    if (!dir.exists() && !dir.mkpath(".")) {
-        setState(Failed);
-        emit failed("Could not create download directory");
-        return;
+/**
+ * @brief Hands over (or drops) what the segments still stage, syncs the files
+ * and waits until the disk writer is done with this item, so files can be
+ * closed. Afterwards every segment resumes from what actually reached the file.
+ */
+void DownloadItem::drainWrites(bool discardPending)
+{
+    for (int i = 0; i < m_segments.size(); ++i) {
+        if (!discardPending) {
+            flushSegment(i);
+            continue;
+        }
+        finishRead(m_segments[i].pending.size());
+        m_segments[i].pending = DiskBuffer();
     }
+    if (!m_writer) return;
 
-    setState(Downloading);
-    setLastTryDate(QDateTime::currentDateTime());
-    fetchTotalSize();
+    if (!discardPending) {
+        // The manifest saved next should not claim data only the page cache holds
+        if (m_outputFile) m_writer->submitSync(this, m_outputFile, -1);
+        for (const Segment &segment : std::as_const(m_segments)) {
+            if (segment.file) m_writer->submitSync(this, segment.file, -1);
+        }
+    }
+    m_writer->waitForOwner(this);
+    QString error;
+    if (!collectWrites(&error)) qWarning() << "Write failed for" << m_fileName << error << "- that data will be fetched again";
+    for (Segment &segment : m_segments) {
+        if (segment.downloaded != segment.written) segment.crcValid = false; // Its CRC ran ahead of the file
+        m_downloadedSize -= segment.downloaded - segment.written;
+        segment.downloaded = segment.written;
+    }
+    m_writer->detach(this);
+    m_writer = nullptr;
 }
 
-void DownloadItem::fetchTotalSize()
+/**
+ * @brief Invoked by the disk writer when writes of ours are done. Finishes the
+ * download once the last byte is in the file.
+ */
+void DownloadItem::onWritesCompleted()
 {
-    QNetworkRequest request = createNetworkRequest(m_url);
-    m_reply = m_manager->head(request);
-    if (!m_reply) {
+    QString error;
+    if (!collectWrites(&error)) {
+        if (m_state != Downloading) return;
+        qCritical() << "Write failed for" << m_fileName << error;
         setState(Failed);
-        emit failed("Failed to initiate download request");
+        emit failed("Failed to write to file: " + error);
+        cleanup(false);
         return;
     }
+    if (m_state != Downloading || m_isSingleChunk || m_segments.isEmpty()) return;
+    if (!catchUpHash(kHashCatchUpBudget)) qWarning() << "Could not read back" << m_fileName << "for hashing, trying again later";
+    if (m_sequential) emitProgress(); // Written data is what availableAt() hands out
+    if (allSegmentsComplete()) finishSegments();
+}
 
-    connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onHeadFinished);
-    connect(m_reply, &QNetworkReply::errorOccurred, this, &DownloadItem::onError);
+/**
+ * @brief Continues a catch-up that ran out of budget in catchUpHash().
+ */
+void DownloadItem::hashCatchUp()
+{
+    m_hashCatchUpQueued = false;
+    if (m_state == Downloading && !m_isSingleChunk) catchUpHash(kHashCatchUpBudget);
 }
 
 /**
- * Handles the completion of the HEAD request.
+ * @brief Takes an expected checksum from Repr-Digest, Digest, Content-MD5 or
+ * x-goog-hash, unless one was given already. Content-MD5 of a 206 is that of
+ * the part, so say when the response is partial.
  */
-void DownloadItem::onHeadFinished()
+void DownloadItem::takeChecksumFromHeaders(const QNetworkReply *reply, bool partialContent)
 {
-    if (!m_reply) {
-        qCritical() << "Null reply in onHeadFinished";
-        setState(Failed);
-        emit failed("Null network reply");
-        return;
-    }
+    if (m_expectedChecksum.isValid()) return;
+    Checksum checksum = Checksum::fromHeaders(reply, partialContent);
+    if (!checksum.isValid()) return;
+    qDebug() << "Server announced" << checksum.toString() << "for" << m_fileName;
+    QMutexLocker locker(&m_snapshotMutex);
+    m_expectedChecksum = checksum;
+}
 
-    if (m_reply->error() == QNetworkReply::NoError) {
-        m_totalSize = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
-        m_supportsRange = m_reply->rawHeader("Accept-Ranges").toLower().contains("bytes");
-        m_isSingleChunk = !m_supportsRange || m_totalSize <= 0;
-        m_numChunks = m_isSingleChunk ? 1 : qBound(4, (int)(m_totalSize / (5 * 1024 * 1024)), 16);
-        qDebug() << "onHeadFinished: totalSize=" << m_totalSize << ", supportsRange=" << m_supportsRange << ", isSingleChunk=" << m_isSingleChunk;
-    } else {
-        qWarning() << "HEAD request failed:" << m_reply->errorString() << ", falling back to GET";
-        m_isSingleChunk = true;
-        m_numChunks = 1;
-        fetchSizeWithGet(); // Fallback to GET if HEAD fails
+/**
+ * @brief Creates the whole-file hasher for the expected algorithm. A segmented
+ * CRC-32C needs none, it is joined from the per-segment CRCs instead. Nor does
+ * a segmented download in large-file mode, which goes unverified: the pages
+ * the hasher would read back are dropped before it gets to them.
+ */
+void DownloadItem::ensureHasher()
+{
+    const Checksum::Algorithm algorithm = m_expectedChecksum.algorithm();
+    const bool needed = m_expectedChecksum.isValid()
+                        && (m_isSingleChunk || (algorithm != Checksum::Crc32c && !m_largeFileMode));
+    if (m_hasher && (!needed || m_hasher->algorithm() != algorithm)) {
+        delete m_hasher;
+        m_hasher = nullptr;
     }
+    if (needed && !m_hasher) m_hasher = new StreamHasher(algorithm);
+}
 
-    m_reply->deleteLater();
-    m_reply = nullptr;
-    if (m_state != Failed && !m_isSingleChunk) startChunkDownloads();
-    else if (m_state != Failed) startSingleChunkDownload();
+void DownloadItem::resetHash()
+{
+    if (m_hasher) m_hasher->reset();
 }
 
 /**
- * Initiates a GET request to estimate the file size as a fallback.
+ * @brief Feeds the hasher where the live data could not be used because it
+ * arrived ahead of the hash position. A digest takes the file in order, so
+ * only the segment holding the hash position is read back, from the page
+ * cache if it still has it; what later segments wrote waits until every
+ * segment before them is done. With N segments about (N-1)/N of the file is
+ * therefore read back from disk towards the end of the download. Data still
+ * staged in memory is taken from there. Reads at most budget bytes (everything
+ * written when budget < 0) and queues another round if more is waiting.
+ * @return false on a read error.
  */
-void DownloadItem::fetchSizeWithGet()
+bool DownloadItem::catchUpHash(qint64 budget)
 {
-    if (!m_url.isValid()) {
-        qDebug() << "Invalid URL in GET fallback:" << m_url;
-        setState(Failed);
-        emit failed("Invalid URL in GET fallback");
-        return;
+    if (!m_hasher) return true;
+
+    QByteArray buffer;
+    while (true) {
+        const qint64 position = m_hasher->position();
+        int index = 0;
+        while (index < m_segments.size() && !(m_segments[index].start <= position && position < m_segments[index].end)) ++index;
+        if (index == m_segments.size()) return true;
+
+        const Segment &segment = m_segments[index];
+        const qint64 available = segment.start + segment.written - position;
+        if (available <= 0) {
+            const qint64 stagedStart = segment.start + segment.downloaded - segment.pending.size();
+            if (!segment.pending.isEmpty()) m_hasher->addData(stagedStart, segment.pending.constData(), segment.pending.size());
+            return true;
+        }
+        if (budget == 0) {
+            if (!m_hashCatchUpQueued) {
+                m_hashCatchUpQueued = true;
+                QMetaObject::invokeMethod(this, "hashCatchUp", Qt::QueuedConnection);
+            }
+            return true;
+        }
+
+        qint64 len = std::min(available, kHashReadSize);
+        if (budget > 0) len = std::min(len, budget);
+        buffer.resize(len);
+        const qint64 read = readSegment(index, position - segment.start, buffer.data(), len);
+        if (read <= 0) return false;
+        m_hasher->addData(position, buffer.constData(), read);
+        if (budget > 0) budget -= read;
     }
-    QNetworkRequest request = createNetworkRequest(m_url);
-    m_reply = m_manager->get(request);
-    if (!m_reply) {
-        setState(Failed);
-        emit failed("Failed to initiate GET request for size estimation");
-        return;
+}
+
+/**
+ * @brief Feeds the hasher from the target file up to length. The single stream
+ * uses it for the part an earlier attempt left in the file.
+ */
+bool DownloadItem::hashFilePrefix(qint64 length)
+{
+    QFile file(m_fullFilePath);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(m_hasher->position())) return false;
+    QByteArray buffer(kHashReadSize, Qt::Uninitialized);
+    while (m_hasher->position() < length) {
+        const qint64 read = file.read(buffer.data(), std::min(kHashReadSize, length - m_hasher->position()));
+        if (read <= 0) return false;
+        m_hasher->addData(m_hasher->position(), buffer.constData(), read);
     }
-    connect(m_reply, &QNetworkReply::readyRead, this, &DownloadItem::onGetReadyRead);
-    connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onGetFinished);
-    connect(m_reply, &QNetworkReply::errorOccurred, this, &DownloadItem::onError);
+    return true;
 }
 
-void DownloadItem::onGetReadyRead()
+/**
+ * @brief Reads written bytes of a segment back, offset being relative to its start.
+ */
+qint64 DownloadItem::readSegment(int chunkIndex, qint64 offset, char *data, qint64 len)
 {
-    if (!m_reply) return;
-    if (m_totalSize <= 0) {
-        m_totalSize = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
-        if (m_totalSize <= 0) {
-            m_totalSize = m_reply->bytesAvailable() + m_downloadedSize;
-            m_reply->abort(); // Stop reading further to save bandwidth
+    Segment &segment = m_segments[chunkIndex];
+    if (m_writeMode == DirectWrite) return m_outputFile ? m_outputFile->readAt(segment.start + offset, data, len) : -1;
+
+    if (!segment.file) { // Finished before a pause, not reopened since
+        segment.file = new SegmentFile(chunkFilePath(chunkIndex));
+        if (!segment.file->open(0)) {
+            delete segment.file;
+            segment.file = nullptr;
+            return -1;
         }
     }
+    return segment.file->readAt(offset, data, len);
 }
 
-void DownloadItem::onGetFinished()
+/**
+ * @brief CRC-32C of the whole file, joined from the per-segment CRCs. Segments
+ * carried over from an earlier session have no CRC; they are read back when
+ * readInvalid is set, otherwise the result is invalid.
+ */
+Checksum DownloadItem::combinedSegmentCrc(bool readInvalid)
 {
-    if (!m_reply) return;
-
-    if (m_reply->error() != QNetworkReply::NoError && m_totalSize <= 0) {
-        m_totalSize = m_downloadedSize + m_reply->bytesAvailable();
-    } else if (m_totalSize <= 0) {
-        m_totalSize = m_downloadedSize + m_reply->bytesAvailable();
+    QList<int> order(m_segments.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return m_segments.at(a).start < m_segments.at(b).start; });
+
+    quint32 crc = 0;
+    QByteArray buffer;
+    for (int index : std::as_const(order)) {
+        Segment &segment = m_segments[index];
+        if (!segment.crcValid) {
+            if (!readInvalid) return Checksum();
+            segment.crc = 0;
+            for (qint64 offset = 0; offset < segment.length();) {
+                buffer.resize(std::min(segment.length() - offset, kHashReadSize));
+                const qint64 read = readSegment(index, offset, buffer.data(), buffer.size());
+                if (read <= 0) return Checksum();
+                segment.crc = crc32cUpdate(segment.crc, buffer.constData(), read);
+                offset += read;
+            }
+            segment.crcValid = true;
+        }
+        crc = crc32cCombine(crc, segment.crc, segment.length());
     }
 
-    m_reply->deleteLater();
-    m_reply = nullptr;
+    QByteArray digest(4, Qt::Uninitialized);
+    qToBigEndian(crc, digest.data());
+    return Checksum(Checksum::Crc32c, digest);
+}
 
-    if (m_state != Failed && m_totalSize > 0) {
-        m_isSingleChunk = true; // Fallback to single chunk after GET
-        startChunkDownloads();
+/**
+ * @brief Computes the checksum of the completed segments and compares it with
+ * the expected one. Only bytes the hash has not seen yet are read back.
+ */
+bool DownloadItem::verifyIntegrity()
+{
+    Checksum actual;
+    if (m_hasher) {
+        if (catchUpHash(-1) && m_hasher->position() == m_totalSize) actual = m_hasher->result();
+    } else if (m_expectedChecksum.isValid() && m_expectedChecksum.algorithm() != Checksum::Crc32c) {
+        // Large-file mode keeps no hasher for segments (see ensureHasher())
+        qWarning() << m_fileName << "is not checked against" << m_expectedChecksum.toString() << "in large-file mode";
+        return true;
     } else {
-        setState(Failed);
-        emit failed("Could not determine file size");
+        actual = combinedSegmentCrc(m_expectedChecksum.isValid());
     }
+    return checkIntegrity(actual);
 }
 
-void DownloadItem::startChunkDownloads()
+/**
+ * @brief Records the computed checksum. If it does not match the expected one
+ * the item fails (as Corrupt when the data was read); the caller drops the data.
+ */
+bool DownloadItem::checkIntegrity(const Checksum &actual)
 {
-    if (m_isSingleChunk) {
-        startSingleChunkDownload();
-        return;
+    {
+        QMutexLocker locker(&m_snapshotMutex);
+        m_actualChecksum = actual;
+    }
+    if (!m_expectedChecksum.isValid()) return true;
+    if (actual == m_expectedChecksum) {
+        m_integrity = Verified;
+        qDebug() << m_fileName << "verified:" << actual.toString();
+        return true;
     }
 
-    initializeChunks();
-    checkPartialChunks();
+    QString reason = "Could not read the file back to verify it";
+    if (actual.isValid()) {
+        m_integrity = Corrupt;
+        reason = QString("Checksum mismatch: expected %1, got %2").arg(m_expectedChecksum.toString(), actual.toString());
+    }
+    qCritical() << reason << "for" << m_fileName;
+    setState(Failed);
+    emit failed(reason);
+    return false;
+}
 
-    for (int i = 0; i < m_numChunks; ++i) {
-        startOrResumeChunk(i);
+/**
+ * @brief Every byte is in place: verify the data, then close or merge.
+ */
+void DownloadItem::finishSegments()
+{
+    if (!verifyIntegrity()) {
+        cleanup(true); // Nothing worth resuming, a retry starts over
+        return;
     }
-    emit progress(m_downloadedSize, m_totalSize);
+    if (m_writeMode == DirectWrite) finishDirectWrite();
+    else mergeChunks();
 }
 
-void DownloadItem::startSingleChunkDownload()
+/**
+ * @brief Called by the rate limiter or memory budget once we may read again:
+ * reads what the replies are holding and finishes those that ended meanwhile.
+ */
+void DownloadItem::resumeReading()
 {
-    if (!m_url.isValid() || m_state != Downloading) return;
+    if (m_state != Downloading) return;
 
-    if (m_file) {
-        m_file->close();
-        delete m_file;
-        m_file = nullptr;
-    }
-    m_file = new QFile(m_fullFilePath);
-    if (!m_file || (!m_file->open(QFile::exists(m_fullFilePath) ? QIODevice::Append : QIODevice::WriteOnly))) {
-        qCritical() << "Failed to open file:" << m_fullFilePath << m_file->errorString();
-        delete m_file;
-        m_file = nullptr;
-        setState(Failed);
-        emit failed("Could not open output file: " + m_file->errorString());
+    if (m_isSingleChunk) {
+        if (m_reply && m_reply->bytesAvailable() > 0) onSingleChunkReadyRead();
+        if (m_reply && m_reply->isFinished()) onSingleChunkFinished();
         return;
     }
+    for (int i = 0; i < m_segments.size(); ++i) {
+        QNetworkReply *reply = m_segments[i].reply;
+        if (reply) {
+            if (reply->bytesAvailable() > 0) onChunkReadyRead(i);
+            if (m_segments[i].reply == reply && reply->isFinished()) onChunkFinished(i);
+        }
+        QNetworkReply *hedge = m_segments[i].hedge;
+        if (hedge) {
+            if (hedge->bytesAvailable() > 0) onHedgeReadyRead(i);
+            if (m_segments[i].hedge == hedge && hedge->isFinished()) onHedgeFinished(i);
+        }
+    }
+}
 
-    m_downloadedSize = QFile::exists(m_fullFilePath) ? m_file->size() : 0;
-    QNetworkRequest request = createNetworkRequest(m_url);
-    if (m_downloadedSize > 0) request.setRawHeader("Range", QString("bytes=%1-").arg(m_downloadedSize).toUtf8());
+// This will start download and file in the current queue, except for which is completed or Downloading
+void DownloadItem::start()
+{
+    if (runInOwnThread([this]() { start(); })) return;
+    if (m_state == Downloading || m_state == Completed) return;
+
+    if (!m_url.isValid()) {
+        setState(Failed);
+        emit failed("Invalid URL provided");
+        return;
+    }
+
+    QFileInfo fileInfo(m_fullFilePath);
+    QDir dir = fileInfo.absoluteDir();
+    setFullFilePath(m_fullFilePath);
+    qDebug () << "File Path"<<dir;
+    if (!dir.exists() && !dir.mkpath(".")) {
+        setState(Failed);
+        emit failed("Could not create download directory");
+        return;
+    }
+    if (m_writeMode == ChunkFiles && !m_chunkDirectory.isEmpty() && !QDir().mkpath(m_chunkDirectory)) {
+        setState(Failed);
+        emit failed("Could not create chunk directory");
+        return;
+    }
+
+    setState(Downloading);
+    m_speed.clear();
+    acquireRuntime();
+    setLastTryDate(QDateTime::currentDateTime());
+    m_hostKey = ConnectionPool::hostKey(m_url);
+    m_host = m_url.host().toLower();
+    resetMirrors();
+    m_http2Checked = false;
+    m_probeFailed = false;
+    m_errorCount = 0;
+    m_singleRetries = 0;
+    m_connections.reset();
+    m_integrity = Unchecked;
+    if (m_checksumUrl.isValid() && !m_expectedChecksum.isValid()) fetchChecksumFile();
+    else fetchTotalSize();
+}
+
+/**
+ * @brief Fetches the checksum file given with setChecksumUrl(); the download
+ * itself starts once it is parsed.
+ */
+void DownloadItem::fetchChecksumFile()
+{
+    m_reply = sendGet(createNetworkRequest(m_checksumUrl));
+    if (!m_reply) {
+        setState(Failed);
+        emit failed("Failed to request the checksum file");
+        return;
+    }
+    connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onChecksumFileFinished);
+}
+
+void DownloadItem::onChecksumFileFinished()
+{
+    if (!m_reply) return;
+    QNetworkReply *reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+    if (m_state != Downloading) return;
+
+    Checksum checksum;
+    if (reply->error() == QNetworkReply::NoError) {
+        // Listed under the remote name, which the local one may differ from
+        checksum = Checksum::fromChecksumFile(reply->readAll(), QFileInfo(m_url.path()).fileName(),
+                                              Checksum::algorithmForUrl(m_checksumUrl));
+    }
+    if (!checksum.isValid()) {
+        qWarning() << "No checksum for" << m_fileName << "in" << m_checksumUrl << reply->errorString();
+        setState(Failed);
+        emit failed("Could not get a checksum from " + m_checksumUrl.toString());
+        return;
+    }
+    qDebug() << "Expecting" << checksum.toString() << "for" << m_fileName;
+    {
+        QMutexLocker locker(&m_snapshotMutex);
+        m_expectedChecksum = checksum;
+    }
+    fetchTotalSize();
+}
+
+void DownloadItem::fetchTotalSize()
+{
+    if (canFastStart()) {
+        sendProbe();
+        return;
+    }
+
+    QNetworkRequest request = createNetworkRequest(m_mirrors.at(m_probeMirror).url);
+    m_reply = sendHead(request);
+    if (!m_reply) {
+        setState(Failed);
+        emit failed("Failed to initiate download request");
+        return;
+    }
+
+    connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onHeadFinished);
+    connect(m_reply, &QNetworkReply::errorOccurred, this, &DownloadItem::onError);
+}
+
+/**
+ * @brief Fast start only applies while nothing of the download is on disk: a
+ * resumed one needs its validators checked before data is requested.
+ */
+bool DownloadItem::canFastStart() const
+{
+    return m_fastStart && !m_probeFailed && m_segments.isEmpty()
+           && !QFile::exists(m_fullFilePath) && !QFile::exists(getManifestPath());
+}
+
+/**
+ * @brief Fast start: asks for the whole file as a range straight away. The
+ * response tells the size and range support like a HEAD would, and its body
+ * becomes the first segment (or the single stream) instead of a wasted trip.
+ */
+void DownloadItem::sendProbe()
+{
+    QNetworkRequest request = createNetworkRequest(m_mirrors.at(m_probeMirror).url);
+    request.setRawHeader("Range", "bytes=0-");
+    m_reply = sendGet(request);
+    if (!m_reply) {
+        setState(Failed);
+        emit failed("Failed to initiate download request");
+        return;
+    }
+    configureReply(m_reply);
+    connect(m_reply, &QNetworkReply::readyRead, this, &DownloadItem::onProbeResponse);
+    connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onProbeResponse);
+}
+
+/**
+ * @brief First sign of the fast-start response: learn what the HEAD would
+ * have told, lay out the segments and keep the connection as segment 0.
+ */
+void DownloadItem::onProbeResponse()
+{
+    QNetworkReply *reply = m_reply;
+    if (!reply) return;
+    disconnect(reply, nullptr, this, nullptr);
+    m_reply = nullptr;
+    if (m_state != Downloading) {
+        reply->abort();
+        reply->deleteLater();
+        return;
+    }
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status != 200 && status != 206) {
+        qWarning() << "Fast start for" << m_fileName << "got HTTP" << status << reply->errorString() << ", asking with HEAD instead";
+        if (!reply->isFinished()) reply->abort();
+        reply->deleteLater();
+        m_probeFailed = true;
+        fetchTotalSize();
+        return;
+    }
+
+    qint64 total = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (status == 206) {
+        // Only a range from the first byte of a known length can become segment 0
+        const QByteArray contentRange = reply->rawHeader("Content-Range");
+        qint64 first = -1;
+        if (!parseContentRange(contentRange, &first, &total) || first != 0 || total <= 0) {
+            qWarning() << "Fast start for" << m_fileName << "got Content-Range" << contentRange << ", asking with HEAD instead";
+            reply->abort();
+            reply->deleteLater();
+            m_probeFailed = true;
+            fetchTotalSize();
+            return;
+        }
+    }
+
+    m_etag = reply->rawHeader("ETag");
+    m_lastModified = reply->rawHeader("Last-Modified");
+    takeChecksumFromHeaders(reply, status == 206);
+    m_totalSize = total > 0 ? total : -1;
+    m_supportsRange = status == 206 && m_totalSize > 0 && !rangeKnownUnsupported();
+    m_isSingleChunk = !m_supportsRange;
+    qDebug() << "Fast start for" << m_fileName << ": HTTP" << status << ", totalSize=" << m_totalSize;
+    if (m_isSingleChunk) {
+        startSingleChunkDownload(reply);
+        return;
+    }
+
+    restoreManifest();
+    initializeChunks();
+    checkPartialChunks();
+    ensureHasher();
+    if (!ensureFreeSpace() || (m_writeMode == DirectWrite && !openOutputFile())) {
+        reply->abort();
+        reply->deleteLater();
+        return;
+    }
+
+    // The request runs to the end of the file; onChunkReadyRead() stops it where segment 0 ends
+    if (usesHostSlots() && !m_pool->reserveConnection(m_mirrors.at(m_probeMirror).hostKey)) {
+        reply->abort(); // Host is at its connection cap; the regular requests fetch the data
+        reply->deleteLater();
+    } else if (!attachSegmentReply(0, reply, m_probeMirror)) {
+        return;
+    }
+    startSegments();
+    emitProgress(true);
+    if (m_segments[0].reply == reply) {
+        if (reply->bytesAvailable() > 0) onChunkReadyRead(0);
+        if (m_segments[0].reply == reply && reply->isFinished()) onChunkFinished(0);
+    }
+}
+
+/**
+ * Handles the completion of the HEAD request.
+ */
+void DownloadItem::onHeadFinished()
+{
+    if (!m_reply) {
+        qCritical() << "Null reply in onHeadFinished";
+        setState(Failed);
+        emit failed("Null network reply");
+        return;
+    }
+
+    if (m_reply->error() == QNetworkReply::NoError) {
+        m_totalSize = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        m_supportsRange = m_reply->rawHeader("Accept-Ranges").toLower().contains("bytes") && !rangeKnownUnsupported();
+        m_isSingleChunk = !m_supportsRange || m_totalSize <= 0;
+        m_numChunks = m_isSingleChunk ? 1 : m_connections.target();
+
+        QByteArray etag = m_reply->rawHeader("ETag");
+        QByteArray lastModified = m_reply->rawHeader("Last-Modified");
+        if (!m_segments.isEmpty() && (etag != m_etag || lastModified != m_lastModified)) {
+            qWarning() << m_fileName << "changed on the server since the last attempt, discarding partial data";
+            discardPartialData();
+        }
+        m_etag = etag;
+        m_lastModified = lastModified;
+        takeChecksumFromHeaders(m_reply);
+        qDebug() << "onHeadFinished: totalSize=" << m_totalSize << ", supportsRange=" << m_supportsRange << ", isSingleChunk=" << m_isSingleChunk.load();
+    } else if (m_probeMirror + 1 < m_mirrors.size()) {
+        qWarning() << "HEAD request to" << m_mirrors.at(m_probeMirror).url << "failed:" << m_reply->errorString() << ", trying the next mirror";
+        m_mirrors.onFailure(m_probeMirror, false);
+        ++m_probeMirror;
+        m_reply->deleteLater();
+        m_reply = nullptr;
+        fetchTotalSize();
+        return;
+    } else {
+        // The single-stream GET learns the size from its own response
+        qWarning() << "HEAD request failed:" << m_reply->errorString() << ", downloading as a single stream";
+        m_isSingleChunk = true;
+        m_numChunks = 1;
+    }
+
+    m_reply->deleteLater();
+    m_reply = nullptr;
+    if (m_state != Failed && !m_isSingleChunk) startChunkDownloads();
+    else if (m_state != Failed) startSingleChunkDownload();
+}
+
+void DownloadItem::startChunkDownloads()
+{
+    if (m_isSingleChunk) {
+        startSingleChunkDownload();
+        return;
+    }
+
+    restoreManifest();
+    initializeChunks();
+    checkPartialChunks();
+    ensureHasher();
+    if (!ensureFreeSpace()) return;
+    if (m_writeMode == DirectWrite && !openOutputFile()) return;
+
+    startSegments();
+    emitProgress(true);
+}
+
+/**
+ * @brief Downloads in one stream, appending to what the file already holds.
+ * A fast-start probe (a fresh file, so from byte 0) is used instead of a new request.
+ */
+void DownloadItem::startSingleChunkDownload(QNetworkReply *probe)
+{
+    if (!m_url.isValid() || m_state != Downloading) {
+        if (probe) probe->deleteLater();
+        return;
+    }
+    if (!ensureFreeSpace()) {
+        if (probe) {
+            probe->abort();
+            probe->deleteLater();
+        }
+        return;
+    }
+
+    if (m_file) {
+        m_file->close();
+        delete m_file;
+        m_file = nullptr;
+    }
+    m_file = new QFile(m_fullFilePath);
+    if (!m_file->open(QFile::exists(m_fullFilePath) ? QIODevice::Append : QIODevice::WriteOnly)) {
+        QString reason = m_file->errorString();
+        qCritical() << "Failed to open file:" << m_fullFilePath << reason;
+        delete m_file;
+        m_file = nullptr;
+        if (probe) {
+            probe->abort();
+            probe->deleteLater();
+        }
+        setState(Failed);
+        emit failed("Could not open output file: " + reason);
+        return;
+    }
+
+    m_downloadedSize = QFile::exists(m_fullFilePath) ? m_file->size() : 0;
+    ensureHasher();
+    if (m_hasher && m_hasher->position() > m_downloadedSize) m_hasher->reset(); // The file was cut short meanwhile
+    QNetworkRequest request = createNetworkRequest(m_url);
+    if (m_downloadedSize > 0) request.setRawHeader("Range", QString("bytes=%1-").arg(m_downloadedSize).toUtf8());
 
-    m_reply = m_manager->get(request);
+    m_reply = probe ? probe : sendGet(request);
+    m_singleResponseChecked = false;
+    m_singleActivity = m_clock.elapsed();
     if (!m_reply) {
         m_file->close();
         delete m_file;
@@ -375,10 +1163,16 @@ void DownloadItem::startSingleChunkDownload()
         emit failed("Failed to initiate download");
         return;
     }
+    if (!probe) configureReply(m_reply);
 
     connect(m_reply, &QNetworkReply::readyRead, this, &DownloadItem::onSingleChunkReadyRead, Qt::UniqueConnection);
     connect(m_reply, &QNetworkReply::finished, this, &DownloadItem::onSingleChunkFinished, Qt::UniqueConnection);
     connect(m_reply, &QNetworkReply::errorOccurred, this, &DownloadItem::onError, Qt::UniqueConnection);
+    if (probe) {
+        // It may have delivered (or even finished) while we were deciding
+        if (m_reply->bytesAvailable() > 0) onSingleChunkReadyRead();
+        if (m_reply && m_reply->isFinished()) onSingleChunkFinished();
+    }
 }
 
 void DownloadItem::onSingleChunkReadyRead()
@@ -396,31 +1190,67 @@ void DownloadItem::onSingleChunkReadyRead()
         return;
     }
 
-    qint64 maxRead = m_speedLimit > 0 ? qMin(m_reply->bytesAvailable(), m_speedLimit / 100) : m_reply->bytesAvailable();
+    if (!m_singleResponseChecked) {
+        m_singleResponseChecked = true;
+        if (m_downloadedSize > 0 && m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+            // Range was ignored and the body starts over; appending it would corrupt the file
+            qWarning() << "Server sent" << m_fileName << "from the start, dropping the" << m_downloadedSize << "bytes kept";
+            m_file->resize(0);
+            m_downloadedSize = 0;
+            resetHash();
+            if (m_pool) m_pool->markRangeUnsupported(m_hostKey);
+        }
+    }
+
+    if (m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() >= 400) return; // Error page; see onSingleChunkFinished()
+    qint64 maxRead = reserveRead(m_reply, m_reply->bytesAvailable(), m_host);
+    if (maxRead <= 0) return; // Throttled or out of memory budget; resumeReading() comes back
     QByteArray data = m_reply->read(maxRead);
+    if (!data.isEmpty()) {
+        m_singleActivity = m_clock.elapsed();
+        m_singleRetries = 0;
+    }
     if (data.isEmpty()) {
+        finishRead(maxRead);
         qDebug() << "No data received, checking reply error:" << m_reply->errorString();
         return;
     }
 
-    enforceSpeedLimit(data.size()); // Enforce limit before writing
     qint64 bytesWritten = m_file->write(data);
+    finishRead(maxRead);
     if (bytesWritten <= 0) {
-        qCritical() << "Write failed:" << m_file->errorString() << "for" << m_fileName;
+        QString reason = m_file->errorString();
+        qCritical() << "Write failed:" << reason << "for" << m_fileName;
         m_file->close();
         delete m_file;
         m_file = nullptr;
         setState(Failed);
-        emit failed("Failed to write to file: " + m_file->errorString());
+        emit failed("Failed to write to file: " + reason);
         return;
     }
+    if (m_largeFileMode) {
+        m_singleWriteback.note(m_file->pos() - bytesWritten, bytesWritten);
+        if (m_singleWriteback.isDue() && m_file->flush()) SegmentFile::writeBack(m_file->handle(), &m_singleWriteback);
+    }
+
+    if (!m_expectedChecksum.isValid() && m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+        takeChecksumFromHeaders(m_reply);
+        ensureHasher();
+    }
+    if (m_hasher) {
+        // Hash what an earlier attempt left in the file first, then follow the stream
+        if (m_hasher->position() < m_downloadedSize && (!m_file->flush() || !hashFilePrefix(m_downloadedSize))) {
+            qWarning() << "Could not hash the start of" << m_fileName << ", trying again at the end";
+        }
+        m_hasher->addData(m_downloadedSize, data.constData(), bytesWritten);
+    }
 
     m_downloadedSize += bytesWritten;
     if (m_totalSize <= 0) {
         QVariant contentLength = m_reply->header(QNetworkRequest::ContentLengthHeader);
         m_totalSize = contentLength.isValid() ? contentLength.toLongLong() : m_downloadedSize;
     }
-    emit progress(m_downloadedSize, m_totalSize > 0 ? m_totalSize : m_downloadedSize);
+    emitProgress();
 }
 void DownloadItem::onSingleChunkFinished()
 {
@@ -429,16 +1259,41 @@ void DownloadItem::onSingleChunkFinished()
         return;
     }
 
+    // Drain what is still buffered; if the limiter holds us back, finish later
+    while (m_reply && m_reply->error() == QNetworkReply::NoError && m_state == Downloading && m_reply->bytesAvailable() > 0) {
+        qint64 buffered = m_reply->bytesAvailable();
+        onSingleChunkReadyRead();
+        if (m_reply && m_reply->bytesAvailable() == buffered) return; // resumeReading() comes back
+    }
+    if (!m_reply) return;
+
     if (m_file && m_file->isOpen()) {
         m_file->close();
     }
     if (m_reply->error() == QNetworkReply::NoError) {
         if (m_totalSize <= 0) m_totalSize = m_downloadedSize;
-        setState(Completed);
-        emit finished();
+        Checksum actual;
+        if (m_hasher && (m_hasher->position() == m_downloadedSize || hashFilePrefix(m_downloadedSize))) actual = m_hasher->result();
+        if (checkIntegrity(actual)) {
+            setState(Completed);
+            emit finished();
+        } else {
+            QFile::remove(m_fullFilePath);
+            m_downloadedSize = 0;
+            resetHash();
+        }
     } else if (m_reply->error() != QNetworkReply::OperationCanceledError) {
-        setState(Failed);
-        emit failed(m_reply->errorString());
+        if (isRetryable(m_reply) && m_errorCount < m_maxRetries) {
+            ++m_errorCount;
+            const qint64 delay = retryDelay(m_singleRetries++, retryAfterMs(m_reply));
+            qWarning() << m_fileName << "failed:" << m_reply->errorString() << ", retrying in" << delay << "ms";
+            QTimer::singleShot(delay, this, [this]() {
+                if (m_state == Downloading && m_isSingleChunk && !m_reply) startSingleChunkDownload(); // Continues where the file ends
+            });
+        } else {
+            setState(Failed);
+            emit failed(m_reply->errorString());
+        }
     }
 
     if (m_reply) {
@@ -451,14 +1306,14 @@ void DownloadItem::onSingleChunkFinished()
 
 void DownloadItem::pause()
 {
+    if (runInOwnThread([this]() { pause(); })) return;
     if (m_state != Downloading) {
-        qDebug() << "pause: Item" << m_fileName << "not in Downloading state, current state:" << m_state;
+        qDebug() << "pause: Item" << m_fileName << "not in Downloading state, current state:" << m_state.load();
         return;
     }
 
     qDebug() << "Pausing HTTP download:" << m_fileName;
     setState(Paused);
-    m_rateTimer->stop();
 
     if (m_reply) {
         disconnect(m_reply, nullptr, this, nullptr);
@@ -478,41 +1333,53 @@ void DownloadItem::pause()
         cleanup(false);
     }
 
-    emit progress(m_downloadedSize, m_totalSize);
+    emitProgress(true);
     qDebug() << "Paused HTTP download:" << m_fileName << "Downloaded:" << m_downloadedSize << "Total:" << m_totalSize;
 }
 
 void DownloadItem::resume()
 {
+    if (runInOwnThread([this]() { resume(); })) return;
     if (m_state != Paused) return;
+    if (m_hostKey.isEmpty() || (m_segments.isEmpty() && !m_isSingleChunk)) {
+        // Loaded from history, or paused before the segments were laid out: go the
+        // start() way, so the manifest is restored and checked against the server
+        start();
+        return;
+    }
 
     setState(Downloading);
-    m_rateTimer->start(1000);
+    acquireRuntime();
+    m_errorCount = 0;
+    m_singleRetries = 0;
     if (m_isSingleChunk) {
         startSingleChunkDownload();
     } else {
         initializeChunks();
         checkPartialChunks();
-        for (int i = 0; i < m_numChunks; ++i) {
-            startOrResumeChunk(i);
-        }
+        ensureHasher();
+        if (!ensureFreeSpace()) return;
+        if (m_writeMode == DirectWrite && !openOutputFile()) return;
+        startSegments();
     }
-    emit progress(m_downloadedSize, m_totalSize);
+    emitProgress(true);
 }
 
 void DownloadItem::stop()
 {
+    if (runInOwnThread([this]() { stop(); })) return;
     if (m_state == Stopped || m_state == Completed || m_state == Failed || m_state == Paused) return;
 
     setState(Stopped);
-    m_rateTimer->stop();
     cleanup(true);
-    emit progress(m_downloadedSize, m_totalSize);
+    emitProgress(true);
 }
 
 void DownloadItem::cleanup(bool deleteFiles)
 {
     qDebug() << "Cleaning up for" << m_fileName << "Delete files:" << deleteFiles;
+    stopMergeThread();
+    drainWrites(deleteFiles);
     if (m_file) {
         if (m_file->isOpen()) {
             m_file->flush();
@@ -525,47 +1392,61 @@ void DownloadItem::cleanup(bool deleteFiles)
         m_file = nullptr;
     }
 
-    for (int i = 0; i < m_chunkReplies.size(); ++i) {
-        if (m_chunkReplies[i]) {
-            disconnect(m_chunkReplies[i], nullptr, this, nullptr); // Disconnect all signals
-            m_chunkReplies[i]->abort();
-            m_chunkReplies[i]->deleteLater();
-            m_chunkReplies[i] = nullptr;
+    if (m_outputFile) {
+        if (deleteFiles) {
+            m_outputFile->remove();
+        } else {
+            m_outputFile->close();
         }
+        delete m_outputFile;
+        m_outputFile = nullptr;
     }
-    m_chunkReplies.clear();
 
-    for (int i = 0; i < m_chunkFiles.size(); ++i) {
-        if (m_chunkFiles[i]) {
-            if (m_chunkFiles[i]->isOpen()) {
-                m_chunkFiles[i]->flush();
-                m_chunkFiles[i]->close();
-            }
-            if (deleteFiles) {
-                m_chunkFiles[i]->remove();
-            }
-            delete m_chunkFiles[i];
-            m_chunkFiles[i] = nullptr;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        dropHedge(i);
+        Segment &segment = m_segments[i];
+        if (segment.reply) {
+            disconnect(segment.reply, nullptr, this, nullptr); // Disconnect all signals
+            segment.reply->abort();
+            segment.reply->deleteLater();
+            segment.reply = nullptr;
+            if (usesHostSlots()) m_pool->releaseConnection(segmentHostKey(i));
+        }
+        if (segment.file) {
+            segment.file->close();
+            delete segment.file;
+            segment.file = nullptr;
+        }
+        if (deleteFiles && m_writeMode == ChunkFiles) {
+            QFile::remove(chunkFilePath(i));
         }
     }
-    m_chunkFiles.clear();
-    m_chunkDownloaded.clear();
-
-    QMutexLocker locker(&m_speedLimitMutex);
-    m_bytesReadThisSecond = 0;
-    m_speedLimitTimer.restart();
+    // The segment table survives a pause so every range can continue in place
+    if (deleteFiles) {
+        m_segments.clear();
+        resetHash();
+        QFile::remove(getManifestPath());
+    } else {
+        saveManifest();
+    }
 }
 
 bool DownloadItem::checkPartialChunks()
 {
     m_downloadedSize = 0;
-    for (int i = 0; i < m_numChunks; ++i) {
-        QString chunkFileName = QString("%1.chunk%2").arg(m_fullFilePath).arg(i);
-        QFile chunkFile(chunkFileName);
-        if (chunkFile.exists()) {
-            m_chunkDownloaded[i] = chunkFile.size();
-            m_downloadedSize += m_chunkDownloaded[i];
+    for (int i = 0; i < m_segments.size(); ++i) {
+        Segment &segment = m_segments[i];
+        if (m_writeMode == ChunkFiles) {
+            QFile chunkFile(chunkFilePath(i));
+            segment.downloaded = chunkFile.exists() ? chunkFile.size() : 0;
+            if (segment.downloaded > segment.length()) {
+                chunkFile.resize(segment.length()); // Left over from a longer range
+                segment.downloaded = segment.length();
+            }
+            if (segment.downloaded != segment.written) segment.crcValid = false;
         }
+        segment.written = segment.downloaded;
+        m_downloadedSize += segment.downloaded;
     }
     return m_downloadedSize > 0;
 }
@@ -573,160 +1454,1164 @@ bool DownloadItem::checkPartialChunks()
 void DownloadItem::initializeChunks()
 {
     m_isSingleChunk = m_totalSize <= 0 || !m_supportsRange;
-    m_numChunks = m_isSingleChunk ? 1 : qBound(4, (int)(m_totalSize / (5 * 1024 * 1024)), 16);
+    m_numChunks = m_isSingleChunk ? 1 : m_connections.target();
 
-    m_chunks.resize(m_numChunks + 1);
-    m_chunkReplies.resize(m_numChunks);
-    m_chunkFiles.resize(m_numChunks);
-    m_chunkDownloaded.resize(m_numChunks);
-    m_chunkReplies.fill(nullptr);
-    m_chunkFiles.fill(nullptr);
-    m_chunkDownloaded.fill(0);
+    // Keep the segment table from a pause if it still describes this file
+    qint64 covered = 0;
+    for (const Segment &segment : m_segments) covered += segment.length();
+    if (m_totalSize <= 0 || covered != m_totalSize) {
+        m_segments.clear();
+        if (m_totalSize <= 0) return;
 
-    if (m_totalSize > 0) {
         qint64 chunkSize = m_totalSize / m_numChunks;
         for (int i = 0; i < m_numChunks; ++i) {
-            m_chunks[i] = i * chunkSize;
+            Segment segment;
+            segment.start = i * chunkSize;
+            segment.end = (i == m_numChunks - 1) ? m_totalSize : (i + 1) * chunkSize;
+            m_segments.append(segment);
         }
-        m_chunks[m_numChunks] = m_totalSize;
     }
+    if (m_sequential && !m_isSingleChunk) cutIntoPieces();
 }
 
-void DownloadItem::startOrResumeChunk(int chunkIndex)
+qint64 DownloadItem::streamPieceSize() const
 {
-    QMutexLocker locker(&m_chunkMutex);
-    qint64 startOffset = m_chunks[chunkIndex];
-    qint64 endOffset = m_chunks[chunkIndex + 1] - 1;
-    qint64 chunkTotalSize = endOffset - startOffset + 1;
+    return qBound(kStreamPieceMin, m_totalSize / kStreamPieces, kStreamPieceMax);
+}
 
-    if (m_totalSize > 0 && m_chunkDownloaded[chunkIndex] >= chunkTotalSize) return;
+// Sequential order: the first and last piece (container headers, and indexes
+// such as MP4's moov atom, live there), then from the playback position on,
+// then whatever lies before it. Lower comes first; ties go by offset.
+int DownloadItem::streamTier(qint64 start, qint64 end) const
+{
+    if (start == 0 || end == m_totalSize) return 0;
+    return end > m_streamPosition ? 1 : 2;
+}
 
-    QNetworkRequest request = createNetworkRequest(m_url);
-    if (m_supportsRange && m_totalSize > 0) {
-        QString rangeHeader = QString("bytes=%1-%2").arg(startOffset + m_chunkDownloaded[chunkIndex]).arg(endOffset);
-        request.setRawHeader("Range", rangeHeader.toUtf8());
+/**
+ * @brief Sequential mode: cuts every range down to one piece past what it
+ * already has and queues the rest as pieces, so connections work where the
+ * data is needed next instead of spread over the whole file. Requests in
+ * flight stop at their new end, as after a split.
+ */
+void DownloadItem::cutIntoPieces()
+{
+    const qint64 piece = streamPieceSize();
+    const int count = m_segments.size();
+    for (int i = 0; i < count; ++i) {
+        if (m_segments[i].hedge) continue;
+        qint64 from = m_segments[i].start + m_segments[i].downloaded + piece;
+        const qint64 end = m_segments[i].end;
+        if (end - from < piece) continue;
+        m_segments[i].end = from;
+        while (from < end) {
+            Segment next;
+            next.start = from;
+            next.end = end - from < 2 * piece ? end : from + piece;
+            from = next.end;
+            m_segments.append(next);
+            if (m_writeMode == ChunkFiles) QFile::remove(chunkFilePath(m_segments.size() - 1)); // Stale file from an earlier layout
+        }
     }
+}
 
-    m_chunkReplies[chunkIndex] = m_manager->get(request);
-    if (!m_chunkReplies[chunkIndex]) {
-        setState(Failed);
-        emit failed("Failed to initiate chunk download");
-        return;
+/**
+ * @brief Opens connections until m_numChunks segments are in flight or no work is left.
+ */
+void DownloadItem::startSegments()
+{
+    while (m_state == Downloading && activeSegmentCount() < m_numChunks) {
+        if (!startNextSegment()) break;
     }
+}
 
-    if (!m_chunkFiles[chunkIndex]) {
-        m_chunkFiles[chunkIndex] = new QFile(QString("%1.chunk%2").arg(m_fullFilePath).arg(chunkIndex));
-        if (!m_chunkFiles[chunkIndex]->open(QIODevice::Append)) {
-            delete m_chunkFiles[chunkIndex];
-            m_chunkFiles[chunkIndex] = nullptr;
-            m_chunkReplies[chunkIndex]->abort();
-            m_chunkReplies[chunkIndex] = nullptr;
-            setState(Failed);
-            emit failed("Could not open chunk file");
-            return;
+/**
+ * @brief Gives a free connection something to do: a pending range if there is
+ * one, otherwise the back half of the largest range still in flight.
+ */
+bool DownloadItem::startNextSegment()
+{
+    const qint64 now = m_clock.elapsed();
+    int next = -1;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        const Segment &segment = m_segments[i];
+        if (segment.reply || segment.remaining() <= 0 || segment.retryAt > now) continue;
+        if (!m_sequential) {
+            next = i;
+            break;
+        }
+        if (next < 0 || std::make_pair(streamTier(segment.start, segment.end), segment.start)
+                            < std::make_pair(streamTier(m_segments[next].start, m_segments[next].end), m_segments[next].start)) {
+            next = i;
         }
     }
-
-    connect(m_chunkReplies[chunkIndex], &QNetworkReply::readyRead, this, [this, chunkIndex]() { onChunkReadyRead(chunkIndex); });
-    connect(m_chunkReplies[chunkIndex], &QNetworkReply::finished, this, [this, chunkIndex]() { onChunkFinished(chunkIndex); });
-    connect(m_chunkReplies[chunkIndex], &QNetworkReply::errorOccurred, this, &DownloadItem::onError);
+    if (next >= 0) {
+        startOrResumeChunk(next);
+        return m_segments[next].reply != nullptr;
+    }
+    return splitLargestSegment();
 }
 
-void DownloadItem::onChunkReadyRead(int chunkIndex)
+bool DownloadItem::splitLargestSegment()
 {
-    if (!m_chunkReplies[chunkIndex] || !m_chunkFiles[chunkIndex]) return;
-
-    qint64 maxRead = m_speedLimit > 0 ? qMin(m_chunkReplies[chunkIndex]->bytesAvailable(), m_speedLimit / 100) : m_chunkReplies[chunkIndex]->bytesAvailable();
-    QByteArray data = m_chunkReplies[chunkIndex]->read(maxRead);
-    if (data.isEmpty()) return;
-
-    enforceSpeedLimit(data.size()); // Enforce limit per chunk
-    qint64 bytesWritten = m_chunkFiles[chunkIndex]->write(data);
-    if (bytesWritten > 0) {
-        m_chunkDownloaded[chunkIndex] += bytesWritten;
-        m_downloadedSize += bytesWritten;
-        emit progress(m_downloadedSize, m_totalSize > 0 ? m_totalSize : m_downloadedSize);
+    int victim = -1;
+    qint64 largest = 0;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        const Segment &segment = m_segments[i];
+        if (segment.reply && segment.remaining() > largest) {
+            victim = i;
+            largest = segment.remaining();
+        }
     }
+    if (victim < 0 || largest < 2 * kMinSplitSize) return false;
+
+    // The victim's request still runs to its old end; onChunkReadyRead stops it at the new one
+    Segment tail;
+    tail.end = m_segments[victim].end;
+    tail.start = tail.end - largest / 2;
+    m_segments[victim].end = tail.start;
+    m_segments.append(tail);
+
+    const int index = m_segments.size() - 1;
+    if (m_writeMode == ChunkFiles) QFile::remove(chunkFilePath(index)); // Stale file from an earlier layout
+    qDebug() << "Split chunk" << victim << "of" << m_fileName << "at" << tail.start << "-> new chunk" << index;
+    startOrResumeChunk(index);
+    return m_segments[index].reply != nullptr;
 }
 
-void DownloadItem::onChunkFinished(int chunkIndex)
+int DownloadItem::activeSegmentCount() const
 {
-    QNetworkReply *reply = m_chunkReplies[chunkIndex];
-    if (!reply) return;
+    return std::accumulate(m_segments.begin(), m_segments.end(), 0,
+                           [](int count, const Segment &s) { return count + (s.reply != nullptr) + (s.hedge != nullptr); });
+}
 
-    if (m_chunkFiles[chunkIndex] && m_chunkFiles[chunkIndex]->isOpen()) m_chunkFiles[chunkIndex]->close();
-    if (reply->error() != QNetworkReply::NoError && reply->error() != QNetworkReply::OperationCanceledError) {
-        setState(Failed);
-        emit failed(reply->errorString());
-        cleanup(false);
-    } else {
-        m_chunkReplies[chunkIndex] = nullptr;
-        bool allDone = std::all_of(m_chunkReplies.begin(), m_chunkReplies.end(), [](QNetworkReply *r) { return !r; });
-        if (allDone && m_state == Downloading) mergeChunks();
-    }
-    reply->deleteLater();
+bool DownloadItem::allSegmentsComplete() const
+{
+    return std::all_of(m_segments.begin(), m_segments.end(), [](const Segment &s) { return !s.reply && s.written >= s.length(); });
 }
 
-void DownloadItem::mergeChunks()
+void DownloadItem::startOrResumeChunk(int chunkIndex)
 {
-    QFile finalFile(m_fullFilePath);
-    if (!finalFile.open(QIODevice::WriteOnly)) {
+    QMutexLocker locker(&m_chunkMutex);
+    Segment &segment = m_segments[chunkIndex];
+    if (segment.reply || segment.remaining() <= 0) return;
+
+    // Best mirror first, skipping those whose host is at its connection cap
+    int mirror = -1;
+    for (int candidate : m_mirrors.ranked(mirrorLoad())) {
+        if (!usesHostSlots() || m_pool->reserveConnection(m_mirrors.at(candidate).hostKey)) {
+            mirror = candidate;
+            break;
+        }
+    }
+    if (mirror < 0) return;
+    const QString hostKey = m_mirrors.at(mirror).hostKey;
+
+    QNetworkRequest request = createNetworkRequest(m_mirrors.at(mirror).url);
+    QString rangeHeader = QString("bytes=%1-%2").arg(segment.start + segment.downloaded).arg(segment.end - 1);
+    request.setRawHeader("Range", rangeHeader.toUtf8());
+    // A changed file then comes back as a full 200 instead of bytes spliced onto old data.
+    // The validators are those of the mirror that answered the HEAD; others differ anyway.
+    QByteArray ifRange = ifRangeValue();
+    if (!ifRange.isEmpty() && mirror == m_probeMirror) request.setRawHeader("If-Range", ifRange);
+
+    QNetworkReply *reply = sendGet(request);
+    if (!reply) {
+        if (usesHostSlots()) m_pool->releaseConnection(hostKey);
         setState(Failed);
-        emit failed("Cannot open final file for merging");
+        emit failed("Failed to initiate chunk download");
         return;
     }
+    configureReply(reply);
+    attachSegmentReply(chunkIndex, reply, mirror);
+}
 
-    for (int i = 0; i < m_numChunks; ++i) {
-        if (m_chunkFiles[i] && m_chunkFiles[i]->open(QIODevice::ReadOnly)) {
-            finalFile.write(m_chunkFiles[i]->readAll());
-            m_chunkFiles[i]->close();
-        } else {
+/**
+ * @brief Makes reply the segment's request: opens its chunk file if needed and
+ * routes the reply's signals. The caller holds the mirror's host slot.
+ * @return false, with the item failed, if the chunk file cannot be opened.
+ */
+bool DownloadItem::attachSegmentReply(int chunkIndex, QNetworkReply *reply, int mirror)
+{
+    Segment &segment = m_segments[chunkIndex];
+    if (m_writeMode == ChunkFiles && !segment.file) {
+        segment.file = new SegmentFile(chunkFilePath(chunkIndex));
+        segment.file->setDropBehind(m_largeFileMode);
+        // Keeps what an earlier request wrote; the file length stays the progress
+        if (!segment.file->open(0) || !segment.file->reserve(segment.downloaded, segment.remaining(), true)) {
+            const QString reason = segment.file->errorString();
+            delete segment.file;
+            segment.file = nullptr;
+            reply->abort();
+            reply->deleteLater();
+            if (usesHostSlots()) m_pool->releaseConnection(m_mirrors.at(mirror).hostKey);
+            setState(Failed);
+            emit failed("Could not open chunk file: " + reason);
+            return false;
+        }
+    }
+
+    segment.reply = reply;
+    segment.requestOffset = segment.downloaded;
+    segment.replyPosition = segment.downloaded;
+    segment.mirror = mirror;
+    segment.sampledBytes = segment.downloaded;
+    segment.rate = 0;
+    segment.requestTime = segment.lastActivity = m_clock.elapsed();
+    m_mirrors.onRequest(mirror);
+    connectSegmentReply(chunkIndex, reply);
+    return true;
+}
+
+void DownloadItem::connectSegmentReply(int chunkIndex, QNetworkReply *reply)
+{
+    connect(reply, &QNetworkReply::readyRead, this, [this, chunkIndex]() { onChunkReadyRead(chunkIndex); });
+    connect(reply, &QNetworkReply::finished, this, [this, chunkIndex]() { onChunkFinished(chunkIndex); });
+}
+
+void DownloadItem::onChunkReadyRead(int chunkIndex)
+{
+    QNetworkReply *reply = m_segments[chunkIndex].reply;
+    if (!reply) return;
+    if (m_writeMode == ChunkFiles ? !m_segments[chunkIndex].file : !m_outputFile) return;
+    if (m_segments[chunkIndex].replyPosition == m_segments[chunkIndex].requestOffset
+        && !validateSegmentResponse(chunkIndex)) return;
+
+    Segment &segment = m_segments[chunkIndex];
+    segment.primaryGain += readSegmentData(chunkIndex, reply, &segment.replyPosition, segmentHost(chunkIndex));
+    emitProgress();
+    if (segment.hedge && segment.primaryGain >= kHedgeDecisionBytes) {
+        dropHedge(chunkIndex); // The first request won the race
+    }
+    if (segment.remaining() <= 0 && !reply->isFinished()) {
+        completeSegment(chunkIndex); // Reached a split point, move this connection on
+    }
+}
+
+/**
+ * @brief Moves what reply has buffered into the segment. *position is where
+ * the reply's data is in the segment; bytes the other request of a hedged
+ * segment already delivered are skipped.
+ * @return the bytes that advanced the segment.
+ */
+qint64 DownloadItem::readSegmentData(int chunkIndex, QNetworkReply *reply, qint64 *position, const QString &host)
+{
+    // Data is staged in blocks that end on kBlockSize boundaries of the file and
+    // written behind by the disk writer; onWritesCompleted() reports back
+    Segment &segment = m_segments[chunkIndex];
+    qint64 gained = 0;
+    while (reply->bytesAvailable() > 0 && segment.remaining() > 0) {
+        if (*position < segment.downloaded) {
+            const qint64 skipped = reply->skip(std::min(segment.downloaded - *position, reply->bytesAvailable()));
+            if (skipped <= 0) break;
+            *position += skipped;
+            continue;
+        }
+        const qint64 fileOffset = (m_writeMode == DirectWrite ? segment.start : 0) + segment.downloaded;
+        const qint64 room = DiskWriter::kBlockSize - fileOffset % DiskWriter::kBlockSize;
+        // The range may have been shortened by a split
+        qint64 reserved = reserveRead(reply, std::min({reply->bytesAvailable(), segment.remaining(), room}), host);
+        if (reserved <= 0) break; // Throttled or out of memory budget; resumeReading() comes back
+
+        if (segment.pending.isEmpty()) {
+            segment.pending = diskWriter()->takeBuffer();
+            segment.pendingOffset = fileOffset;
+        }
+        const qsizetype staged = segment.pending.size();
+        segment.pending.resize(staged + reserved);
+        const qint64 received = qMax<qint64>(0, reply->read(segment.pending.data() + staged, reserved));
+        segment.pending.resize(staged + received);
+        finishRead(reserved - received); // The rest is returned once written
+        if (received == 0) break;
+
+        const char *data = segment.pending.constData() + staged;
+        segment.crc = crc32cUpdate(segment.crc, data, received);
+        if (m_hasher) m_hasher->addData(segment.start + segment.downloaded, data, received);
+        segment.downloaded += received;
+        m_downloadedSize += received;
+        *position += received;
+        gained += received;
+        segment.lastActivity = m_clock.elapsed();
+        segment.retries = 0;
+        if (received == room || segment.remaining() <= 0) flushSegment(chunkIndex);
+    }
+    return gained;
+}
+
+/**
+ * @brief End game: nothing is left to hand out or split, so spare connections
+ * race the segments that would finish last. A second request asks for the same
+ * remaining bytes; whichever request first adds kHedgeDecisionBytes to the
+ * segment keeps it and the other is cancelled.
+ */
+void DownloadItem::hedgeTail()
+{
+    if (m_isSingleChunk || m_state != Downloading) return;
+    const qint64 now = m_clock.elapsed();
+    for (int spare = m_numChunks - activeSegmentCount(); spare > 0; --spare) {
+        int laggard = -1;
+        double latest = kHedgeMinSecondsLeft;
+        for (int i = 0; i < m_segments.size(); ++i) {
+            const Segment &segment = m_segments[i];
+            if (!segment.reply || segment.hedge || segment.remaining() <= 0) continue;
+            if (now - segment.requestTime < kHedgeMinAgeMs) continue; // Still getting up to speed
+            const double secondsLeft = segment.rate > 0 ? double(segment.remaining()) / segment.rate : 1e9;
+            if (secondsLeft > latest) {
+                latest = secondsLeft;
+                laggard = i;
+            }
+        }
+        if (laggard < 0 || !startHedge(laggard)) return;
+    }
+}
+
+bool DownloadItem::startHedge(int chunkIndex)
+{
+    Segment &segment = m_segments[chunkIndex];
+    // Another mirror if there is one; the same one over a fresh connection otherwise
+    QList<int> candidates = m_mirrors.ranked(mirrorLoad());
+    if (candidates.removeOne(segment.mirror)) candidates.append(segment.mirror);
+    int mirror = -1;
+    for (int candidate : std::as_const(candidates)) {
+        if (!usesHostSlots() || m_pool->reserveConnection(m_mirrors.at(candidate).hostKey)) {
+            mirror = candidate;
+            break;
+        }
+    }
+    if (mirror < 0) return false;
+
+    QNetworkRequest request = createNetworkRequest(m_mirrors.at(mirror).url);
+    request.setRawHeader("Range", QString("bytes=%1-%2").arg(segment.start + segment.downloaded).arg(segment.end - 1).toUtf8());
+    QByteArray ifRange = ifRangeValue();
+    if (!ifRange.isEmpty() && mirror == m_probeMirror) request.setRawHeader("If-Range", ifRange);
+    QNetworkReply *hedge = sendGet(request);
+    if (!hedge) {
+        if (usesHostSlots()) m_pool->releaseConnection(m_mirrors.at(mirror).hostKey);
+        return false;
+    }
+    configureReply(hedge);
+
+    qDebug() << "Hedging chunk" << chunkIndex << "of" << m_fileName << "(" << segment.remaining() << "bytes left at"
+             << segment.rate << "B/s) on" << m_mirrors.at(mirror).url.host();
+    segment.hedge = hedge;
+    segment.hedgeMirror = mirror;
+    segment.hedgeOffset = segment.downloaded;
+    segment.hedgePosition = segment.downloaded;
+    segment.hedgeGain = 0;
+    segment.primaryGain = 0;
+    m_mirrors.onRequest(mirror);
+    connect(hedge, &QNetworkReply::readyRead, this, [this, chunkIndex]() { onHedgeReadyRead(chunkIndex); });
+    connect(hedge, &QNetworkReply::finished, this, [this, chunkIndex]() { onHedgeFinished(chunkIndex); });
+    return true;
+}
+
+void DownloadItem::onHedgeReadyRead(int chunkIndex)
+{
+    Segment &segment = m_segments[chunkIndex];
+    QNetworkReply *hedge = segment.hedge;
+    if (!hedge) return;
+    if (segment.hedgePosition == segment.hedgeOffset) {
+        const int status = hedge->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        qint64 first = -1;
+        qint64 total = -1;
+        if (status != 206 || !parseContentRange(hedge->rawHeader("Content-Range"), &first, &total)
+            || first != segment.start + segment.hedgeOffset || (total > 0 && total != m_totalSize)) {
+            qWarning() << "Hedge for chunk" << chunkIndex << "of" << m_fileName << "got HTTP" << status << ", dropping it";
+            dropHedge(chunkIndex);
+            return;
+        }
+    }
+
+    segment.hedgeGain += readSegmentData(chunkIndex, hedge, &segment.hedgePosition, m_mirrors.at(segment.hedgeMirror).host);
+    emitProgress();
+    if (segment.hedgeGain >= kHedgeDecisionBytes) promoteHedge(chunkIndex);
+    // Done; a finished reply is completed by its finished handler
+    if (segment.remaining() <= 0 && !hedge->isFinished()) completeSegment(chunkIndex);
+}
+
+void DownloadItem::onHedgeFinished(int chunkIndex)
+{
+    QNetworkReply *hedge = m_segments[chunkIndex].hedge;
+    if (!hedge) return;
+    if (hedge->error() == QNetworkReply::NoError && hedge->bytesAvailable() > 0) onHedgeReadyRead(chunkIndex);
+    if (m_segments[chunkIndex].reply == hedge) {
+        onChunkFinished(chunkIndex); // Won while draining; finish it as the segment's request
+        return;
+    }
+    if (m_segments[chunkIndex].hedge != hedge) return;
+    if (m_segments[chunkIndex].remaining() <= 0) {
+        completeSegment(chunkIndex);
+        return;
+    }
+    if (hedge->bytesAvailable() > 0 && m_segments[chunkIndex].remaining() > 0 && m_state == Downloading) {
+        return; // Throttled; resumeReading() drains and finishes it
+    }
+    dropHedge(chunkIndex); // Failed or ended early; the first request carries on
+}
+
+/**
+ * @brief The hedge won: cancel the first request and make the hedge the
+ * segment's request.
+ */
+void DownloadItem::promoteHedge(int chunkIndex)
+{
+    Segment &segment = m_segments[chunkIndex];
+    QNetworkReply *loser = segment.reply;
+    if (loser) {
+        disconnect(loser, nullptr, this, nullptr);
+        if (!loser->isFinished()) loser->abort();
+        loser->deleteLater();
+        if (usesHostSlots()) m_pool->releaseConnection(segmentHostKey(chunkIndex));
+    }
+    qDebug() << "Hedge won chunk" << chunkIndex << "of" << m_fileName;
+    QNetworkReply *hedge = segment.hedge;
+    segment.reply = hedge;
+    segment.mirror = segment.hedgeMirror;
+    segment.requestOffset = segment.hedgeOffset;
+    segment.replyPosition = segment.hedgePosition;
+    segment.sampledBytes = segment.downloaded;
+    segment.requestTime = m_clock.elapsed();
+    segment.hedge = nullptr;
+    segment.hedgeMirror = -1;
+    disconnect(hedge, nullptr, this, nullptr);
+    connectSegmentReply(chunkIndex, hedge);
+}
+
+void DownloadItem::dropHedge(int chunkIndex)
+{
+    Segment &segment = m_segments[chunkIndex];
+    QNetworkReply *hedge = segment.hedge;
+    if (!hedge) return;
+    segment.hedge = nullptr;
+    disconnect(hedge, nullptr, this, nullptr);
+    if (!hedge->isFinished()) hedge->abort();
+    hedge->deleteLater();
+    if (usesHostSlots()) m_pool->releaseConnection(m_mirrors.at(segment.hedgeMirror).hostKey);
+    segment.hedgeMirror = -1;
+}
+
+/**
+ * @brief Reconnects requests that delivered nothing for the stall timeout
+ * instead of waiting for TCP to give up. The range continues on a new request,
+ * on another mirror if the set has one.
+ */
+void DownloadItem::resetStalledSegments()
+{
+    const qint64 now = m_clock.elapsed();
+    if (m_isSingleChunk) {
+        if (!m_reply || !m_file || now - m_singleActivity < m_stallTimeoutMs) return;
+        qWarning() << m_fileName << "received nothing for" << (now - m_singleActivity) / 1000 << "s, reconnecting";
+        disconnect(m_reply, nullptr, this, nullptr);
+        m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+        startSingleChunkDownload(); // Continues where the file ends
+        return;
+    }
+
+    bool released = false;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        Segment &segment = m_segments[i];
+        if (!segment.reply || now - segment.lastActivity < m_stallTimeoutMs) continue;
+        qWarning() << "Chunk" << i << "of" << m_fileName << "received nothing for" << (now - segment.lastActivity) / 1000 << "s, reconnecting";
+        if (m_mirrors.size() > 1 && segment.mirror >= 0) m_mirrors.onFailure(segment.mirror, false);
+        releaseSegment(i);
+        released = true;
+    }
+    if (released && m_mirrors.hasUsable()) startSegments();
+}
+
+void DownloadItem::onChunkFinished(int chunkIndex)
+{
+    QNetworkReply *reply = m_segments[chunkIndex].reply;
+    if (!reply) return;
+
+    if (reply->error() != QNetworkReply::NoError && reply->error() != QNetworkReply::OperationCanceledError) {
+        if (m_segments[chunkIndex].hedge) {
+            qWarning() << "Chunk" << chunkIndex << "of" << m_fileName << "failed:" << reply->errorString() << ", its hedge carries on";
+            promoteHedge(chunkIndex);
+            return;
+        }
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        const bool retryable = isRetryable(reply);
+        const QString reason = reply->errorString();
+        const qint64 retryAfter = retryAfterMs(reply);
+        // Fatal errors will not go away by asking that mirror again
+        if (failMirror(chunkIndex, !retryable)) return;
+        if (!retryable || (m_mirrors.size() > 1 && !m_mirrors.hasUsable())) {
+            failWithError(reason);
+            return;
+        }
+        const bool throttled = (status == 429 || status == 503) && activeSegmentCount() > 1;
+        retrySegment(chunkIndex, retryAfter, reason);
+        if (throttled && m_state == Downloading) {
+            // Too many connections for this server
+            qWarning() << "Chunk" << chunkIndex << "of" << m_fileName << "got HTTP" << status << ", reducing connections";
+            m_numChunks = m_connections.onThrottled();
+            adjustConnections(false);
+        }
+        return;
+    }
+
+    // Drain whatever is still buffered before deciding if the range is done
+    while (m_segments[chunkIndex].reply == reply && m_state == Downloading) {
+        qint64 buffered = reply->bytesAvailable();
+        if (buffered <= 0) break;
+        onChunkReadyRead(chunkIndex);
+        if (m_segments[chunkIndex].reply == reply && reply->bytesAvailable() == buffered) break;
+    }
+    if (m_segments[chunkIndex].reply != reply) return; // Completed while draining
+    if (reply->bytesAvailable() > 0 && m_segments[chunkIndex].remaining() > 0 && m_state == Downloading) {
+        return; // Throttled; resumeReading() drains and finishes it
+    }
+
+    const Segment &segment = m_segments[chunkIndex];
+    if (segment.remaining() > 0 && segment.hedge) {
+        promoteHedge(chunkIndex); // Ended early; the hedge still covers the rest
+        return;
+    }
+    if (segment.remaining() > 0 && segment.replyPosition == segment.requestOffset) {
+        if (failMirror(chunkIndex, false)) return;
+        retrySegment(chunkIndex, -1, QString("Server closed chunk %1 without sending data").arg(chunkIndex));
+        return;
+    }
+    completeSegment(chunkIndex);
+}
+
+/**
+ * @brief Releases a segment's connection. A short range stays pending and is
+ * picked up again by startNextSegment().
+ */
+void DownloadItem::completeSegment(int chunkIndex)
+{
+    const Segment &segment = m_segments[chunkIndex];
+    if (segment.mirror >= 0 && segment.downloaded > segment.requestOffset) m_mirrors.onSuccess(segment.mirror);
+    releaseSegment(chunkIndex);
+
+    if (m_state != Downloading) return;
+    if (allSegmentsComplete()) {
+        finishSegments();
+        return;
+    }
+    startSegments();
+}
+
+/**
+ * @brief Detaches the reply from a segment and hands its staged data to the
+ * disk writer, leaving its range in the table.
+ */
+void DownloadItem::releaseSegment(int chunkIndex)
+{
+    dropHedge(chunkIndex);
+    Segment &segment = m_segments[chunkIndex];
+    if (segment.reply) {
+        QNetworkReply *reply = segment.reply;
+        segment.reply = nullptr;
+        disconnect(reply, nullptr, this, nullptr);
+        if (!reply->isFinished()) reply->abort();
+        reply->deleteLater();
+        if (usesHostSlots()) m_pool->releaseConnection(segmentHostKey(chunkIndex));
+    }
+    // The chunk file stays open until cleanup(); the disk writer may still be using it
+    flushSegment(chunkIndex);
+}
+
+/**
+ * @brief Feeds the latest throughput to the connection controller (when sample
+ * is true) and opens or drops connections to match its target.
+ */
+void DownloadItem::adjustConnections(bool sample)
+{
+    if (m_isSingleChunk || m_state != Downloading || m_segments.isEmpty()) return;
+    if (sample) m_numChunks = m_connections.sample(m_speed.lastRate()); // It smooths on its own
+
+    int active = activeSegmentCount();
+    if (active < m_numChunks) {
+        startSegments();
+        return;
+    }
+    // Hedges go first, then the most recently opened connections; their ranges become pending again
+    for (int i = m_segments.size() - 1; i >= 0 && active > m_numChunks; --i) {
+        if (m_segments[i].hedge) {
+            dropHedge(i);
+            --active;
+        }
+    }
+    for (int i = m_segments.size() - 1; i >= 0 && active > m_numChunks; --i) {
+        if (m_segments[i].reply) {
+            releaseSegment(i);
+            --active;
+        }
+    }
+}
+
+/**
+ * @brief Sources for this run: the URL first, then the mirrors in the order given.
+ */
+void DownloadItem::resetMirrors()
+{
+    QList<QUrl> urls{m_url};
+    urls += getMirrors();
+    m_mirrors.reset(urls);
+    m_probeMirror = 0;
+    if (m_mirrors.size() > 1) qDebug() << m_fileName << "has" << m_mirrors.size() << "sources";
+}
+
+// Connections open per mirror
+QList<int> DownloadItem::mirrorLoad() const
+{
+    QList<int> load(m_mirrors.size(), 0);
+    for (const Segment &segment : m_segments) {
+        if (segment.reply && segment.mirror >= 0 && segment.mirror < load.size()) ++load[segment.mirror];
+        if (segment.hedge && segment.hedgeMirror >= 0 && segment.hedgeMirror < load.size()) ++load[segment.hedgeMirror];
+    }
+    return load;
+}
+
+QString DownloadItem::segmentHostKey(int chunkIndex) const
+{
+    const int mirror = m_segments[chunkIndex].mirror;
+    return mirror >= 0 && mirror < m_mirrors.size() ? m_mirrors.at(mirror).hostKey : m_hostKey;
+}
+
+QString DownloadItem::segmentHost(int chunkIndex) const
+{
+    const int mirror = m_segments[chunkIndex].mirror;
+    return mirror >= 0 && mirror < m_mirrors.size() ? m_mirrors.at(mirror).host : m_host;
+}
+
+/**
+ * @brief A request to one of several mirrors failed: demote (or drop) that
+ * mirror and hand the segment's range to the others.
+ * @return false with a single source or no mirror left; the caller then fails
+ * the download.
+ */
+bool DownloadItem::failMirror(int chunkIndex, bool permanent)
+{
+    const int mirror = m_segments[chunkIndex].mirror;
+    if (m_mirrors.size() < 2 || mirror < 0) return false;
+
+    qWarning() << "Chunk" << chunkIndex << "of" << m_fileName << "failed on" << m_mirrors.at(mirror).url;
+    m_mirrors.onFailure(mirror, permanent);
+    releaseSegment(chunkIndex);
+    if (!m_mirrors.hasUsable()) return false;
+    startSegments();
+    return true;
+}
+
+/**
+ * @brief Puts the range of a request that hit a transient error back in the
+ * pool until its backoff (or the server's Retry-After) has passed; the other
+ * segments carry on meanwhile. Each retry spends one unit of the run's error
+ * budget, and the item only fails once it is gone.
+ */
+void DownloadItem::retrySegment(int chunkIndex, qint64 retryAfterMs, const QString &reason)
+{
+    releaseSegment(chunkIndex);
+    if (m_errorCount >= m_maxRetries) {
+        failWithError(QString("%1 (gave up after %2 retries)").arg(reason).arg(m_errorCount));
+        return;
+    }
+    ++m_errorCount;
+    Segment &segment = m_segments[chunkIndex];
+    const qint64 delay = retryDelay(segment.retries++, retryAfterMs);
+    segment.retryAt = m_clock.elapsed() + delay;
+    qWarning() << "Chunk" << chunkIndex << "of" << m_fileName << "failed:" << reason << ", retrying in" << delay << "ms";
+    QTimer::singleShot(delay, this, [this]() {
+        if (m_state == Downloading && !m_isSingleChunk) startSegments();
+    });
+    startSegments(); // A free connection may pick up another range meanwhile
+}
+
+void DownloadItem::failWithError(const QString &reason)
+{
+    setState(Failed);
+    emit failed(reason);
+    cleanup(false);
+}
+
+/**
+ * @brief Hands the finished chunk files to a ChunkMerger running on its own
+ * thread. Completion is reported back through onMergeFinished().
+ */
+void DownloadItem::mergeChunks()
+{
+    if (m_mergeThread) return;
+
+    QList<ChunkMerger::Part> parts;
+    for (int i = 0; i < m_segments.size(); ++i) {
+        const Segment &segment = m_segments[i];
+        QString path = chunkFilePath(i);
+        if (QFileInfo(path).size() != segment.length()) {
             setState(Failed);
             emit failed(QString("Could not read chunk %1 for merging").arg(i));
-            finalFile.remove();
             return;
         }
+        parts.append(ChunkMerger::Part{path, segment.start, segment.length()});
+    }
+
+    m_merger = new ChunkMerger(m_fullFilePath, parts, m_totalSize);
+    m_mergeThread = new QThread(this);
+    m_merger->moveToThread(m_mergeThread);
+    connect(m_mergeThread, &QThread::started, m_merger, &ChunkMerger::run);
+    connect(m_merger, &ChunkMerger::progress, this, &DownloadItem::mergeProgress);
+    connect(m_merger, &ChunkMerger::finished, this, &DownloadItem::onMergeFinished);
+    m_mergeThread->start();
+    qDebug() << "Merging" << parts.size() << "chunks for" << m_fileName;
+}
+
+void DownloadItem::onMergeFinished(bool ok, const QString &error)
+{
+    stopMergeThread();
+    if (m_state != Downloading) return; // Paused or stopped while merging
+
+    if (!ok) {
+        QFile::remove(m_fullFilePath);
+        setState(Failed);
+        emit failed(error);
+        return;
     }
 
-    finalFile.close();
     cleanup(true);
     setState(Completed);
     emit finished();
 }
 
-void DownloadItem::onError(QNetworkReply::NetworkError code)
+void DownloadItem::stopMergeThread()
 {
-    if (code != QNetworkReply::OperationCanceledError) {
+    if (!m_mergeThread) return;
+    m_merger->cancel();
+    m_mergeThread->quit();
+    m_mergeThread->wait();
+    delete m_merger;
+    m_merger = nullptr;
+    delete m_mergeThread;
+    m_mergeThread = nullptr;
+}
+
+/**
+ * @brief Disk space the item has yet to claim: what the target does not occupy
+ * yet, plus room for the merged copy while ChunkFiles segments are apart.
+ * Reads the published sizes, so any thread may ask.
+ */
+qint64 DownloadItem::spaceNeeded() const
+{
+    return spaceNeededFor(m_shownTotal.load(std::memory_order_relaxed), m_shownDownloaded.load(std::memory_order_relaxed));
+}
+
+qint64 DownloadItem::spaceNeededFor(qint64 total, qint64 downloaded) const
+{
+    if (total <= 0 || m_state == Completed) return 0;
+    const qint64 allocated = SegmentFile::allocatedSize(m_fullFilePath);
+    if (m_writeMode == ChunkFiles && !m_isSingleChunk) return qMax<qint64>(0, 2 * total - downloaded - allocated);
+    return qMax<qint64>(0, total - allocated);
+}
+
+/**
+ * @brief Fails the item before any transfer when its volume cannot hold the
+ * rest of it, instead of finding out once the disk is full.
+ */
+bool DownloadItem::ensureFreeSpace()
+{
+    const qint64 needed = spaceNeededFor(m_totalSize, m_downloadedSize);
+    if (needed <= 0) return true;
+    const QStorageInfo volume = SegmentFile::volumeOf(m_fullFilePath);
+    if (!volume.isValid() || volume.bytesAvailable() >= needed) return true;
+    qWarning() << m_fileName << "needs" << needed << "bytes on" << volume.rootPath() << ", only" << volume.bytesAvailable() << "free";
+    // Published now, so the manager holds the item instead of starting it again
+    m_shownTotal.store(m_totalSize, std::memory_order_relaxed);
+    m_shownDownloaded.store(m_downloadedSize, std::memory_order_relaxed);
+    setState(Queued);
+    emit spaceShortage(needed, volume.bytesAvailable());
+    return false;
+}
+
+/**
+ * @brief Opens (and sizes) the target file that DirectWrite segments write into.
+ */
+bool DownloadItem::openOutputFile()
+{
+    if (!m_outputFile) m_outputFile = new SegmentFile(m_fullFilePath);
+    m_outputFile->setDropBehind(m_largeFileMode);
+    if (!m_outputFile->open(m_totalSize)) {
+        QString reason = m_outputFile->errorString();
+        delete m_outputFile;
+        m_outputFile = nullptr;
         setState(Failed);
-        emit failed(m_reply ? m_reply->errorString() : "Network error");
-    }
-    if (m_reply) {
-        m_reply->deleteLater();
-        m_reply = nullptr;
+        emit failed("Could not open output file: " + reason);
+        return false;
     }
-    for (QNetworkReply *reply : m_chunkReplies) {
-        if (reply) {
-            reply->deleteLater();
-            reply = nullptr;
-        }
+    return true;
+}
+
+/**
+ * @brief Completes a DirectWrite download. Every byte is already in place, so
+ * this only closes the file.
+ */
+void DownloadItem::finishDirectWrite()
+{
+    cleanup(false);
+    m_segments.clear();
+    QFile::remove(getManifestPath());
+    setState(Completed);
+    emit finished();
+}
+
+void DownloadItem::onError(QNetworkReply::NetworkError code)
+{
+    // finished() follows and decides between retrying and failing
+    if (code != QNetworkReply::OperationCanceledError) {
+        qWarning() << m_fileName << "network error" << code << (m_reply ? m_reply->errorString() : QString());
     }
 }
 
+void DownloadItem::tick()
+{
+    if (runInOwnThread([this]() { tick(); })) return;
+    if (m_state == Downloading) updateTransferRate();
+}
+
 void DownloadItem::updateTransferRate()
 {
     qint64 currentTime = QDateTime::currentMSecsSinceEpoch();
     qint64 timeDiff = currentTime - m_lastUpdateTime;
     if (timeDiff > 0) {
-        qint64 bytesDiff = m_downloadedSize - m_bytesLastPeriod;
-        m_transferRate = (bytesDiff * 1000) / timeDiff;
-        m_bytesLastPeriod = m_downloadedSize;
+        m_speed.addSample(m_downloadedSize, timeDiff);
+        m_transferRate = m_speed.rate();
         m_lastUpdateTime = currentTime;
+        for (Segment &segment : m_segments) {
+            if (!segment.reply || segment.mirror < 0) continue;
+            segment.rate = (segment.downloaded - segment.sampledBytes) * 1000 / timeDiff;
+            m_mirrors.onSample(segment.mirror, segment.downloaded - segment.sampledBytes, timeDiff);
+            segment.sampledBytes = segment.downloaded;
+        }
+        resetStalledSegments();
+        adjustConnections(true);
+        hedgeTail();
+        {
+            QMutexLocker locker(&m_snapshotMutex);
+            m_snapshot.secondsLeft = m_totalSize > 0 ? m_speed.secondsLeft(m_totalSize - m_downloadedSize) : -1;
+            m_speedHistory = m_speed.history();
+        }
+        emitProgress();
     }
+    if (m_state == Downloading) saveManifest();
+}
+
+/**
+ * @brief Checks the first response of a segment request. A 200 to a request
+ * carrying If-Range means the remote file changed under us.
+ * @return false if the download was restarted and the reply is gone.
+ */
+bool DownloadItem::validateSegmentResponse(int chunkIndex)
+{
+    QNetworkReply *reply = m_segments[chunkIndex].reply;
+    if (m_transport == Http2 && !m_http2Checked) {
+        m_http2Checked = true;
+        qDebug() << m_fileName << (reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool()
+                                       ? "is multiplexed over HTTP/2" : "fell back to HTTP/1.1 (no h2 from ALPN)");
+    }
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const Segment &segment = m_segments[chunkIndex];
+    const int mirror = segment.mirror;
+    const QByteArray contentRange = reply->rawHeader("Content-Range");
+    qint64 first = -1;
+    qint64 total = -1;
+    const bool isRange = status == 206 && parseContentRange(contentRange, &first, &total);
+    if (status >= 400) return false; // An error page; onChunkFinished() deals with the error
+    if (mirror != m_probeMirror && m_mirrors.size() > 1) {
+        // Asked without If-Range: the mirror has to answer with the range, of a file the same size
+        if (!isRange || first != segment.start + segment.requestOffset || (total > 0 && total != m_totalSize)) {
+            qWarning() << m_mirrors.at(mirror).url << "does not serve the same file by range (HTTP" << status << contentRange << ")";
+            if (!failMirror(chunkIndex, true)) {
+                setState(Failed);
+                emit failed("No mirror left that serves this file");
+                cleanup(false);
+            }
+            return false;
+        }
+        return true;
+    }
+    // A 200 to If-Range means the file changed, unless the validator is still the same:
+    // then the server just ignores Range
+    const QByteArray ifRange = ifRangeValue();
+    if (status == 200 && !ifRange.isEmpty() && reply->rawHeader(ifRange == m_etag ? "ETag" : "Last-Modified") != ifRange) {
+        restartFromScratch();
+        return false;
+    }
+    if (isRange && total > 0 && total != m_totalSize) {
+        restartFromScratch(); // Another size, so another file
+        return false;
+    }
+    if (!isRange || first != segment.start + segment.requestOffset) {
+        // Every other segment would get the same answer: the whole file again, or the wrong bytes
+        qWarning() << m_mirrors.at(mirror).url.host() << "answered a range request with HTTP" << status << contentRange;
+        collapseToSingleStream();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Value for If-Range: a strong ETag if we have one, else Last-Modified.
+ * Weak ETags are not allowed in If-Range.
+ */
+QByteArray DownloadItem::ifRangeValue() const
+{
+    if (!m_etag.isEmpty() && !m_etag.startsWith("W/")) return m_etag;
+    return m_lastModified;
+}
+
+/**
+ * @brief Writes the segment table to the sidecar manifest. Only bytes the disk
+ * writer has finished are recorded, so it never claims data still in memory.
+ */
+void DownloadItem::saveManifest()
+{
+    if (m_isSingleChunk || m_segments.isEmpty() || m_totalSize <= 0) return;
+
+    ResumeManifest manifest;
+    manifest.url = m_url;
+    manifest.totalSize = m_totalSize;
+    manifest.etag = m_etag;
+    manifest.lastModified = m_lastModified;
+    manifest.chunkFiles = m_writeMode == ChunkFiles;
+    for (const Segment &segment : m_segments) manifest.ranges.append({segment.start, segment.end, segment.written});
+    manifest.save(getManifestPath());
+}
+
+/**
+ * @brief Rebuilds the segment table from the manifest left by an earlier
+ * session, provided the remote file still matches it.
+ */
+void DownloadItem::restoreManifest()
+{
+    if (!m_segments.isEmpty()) return; // Paused in this session, the table is still live
+
+    ResumeManifest manifest;
+    if (!manifest.load(getManifestPath())) {
+        // Without a manifest the layout of old chunk files is unknown
+        if (m_writeMode == ChunkFiles) discardPartialData();
+        return;
+    }
+    if (!manifest.matches(m_totalSize, m_etag, m_lastModified)
+        || manifest.chunkFiles != (m_writeMode == ChunkFiles)) {
+        qWarning() << "Resume data for" << m_fileName << "does not match the remote file, starting over";
+        discardPartialData();
+        return;
+    }
+
+    for (const ResumeManifest::Range &range : manifest.ranges) {
+        Segment segment;
+        segment.start = range.start;
+        segment.end = range.end;
+        segment.downloaded = range.downloaded;
+        segment.written = range.downloaded;
+        segment.crcValid = range.downloaded == 0; // Data of an earlier session, read back if a CRC is needed
+        m_segments.append(segment);
+    }
+    if (m_etag.isEmpty()) m_etag = manifest.etag;
+    if (m_lastModified.isEmpty()) m_lastModified = manifest.lastModified;
+    qDebug() << "Restored" << m_segments.size() << "segments for" << m_fileName << "from" << getManifestPath();
+}
+
+/**
+ * @brief Forgets all partial data: segment table, manifest and chunk files.
+ */
+void DownloadItem::discardPartialData()
+{
+    if (m_writeMode == ChunkFiles) {
+        for (int i = 0; i < m_segments.size() || QFile::exists(chunkFilePath(i)); ++i) QFile::remove(chunkFilePath(i));
+    }
+    m_segments.clear();
+    m_downloadedSize = 0;
+    resetHash();
+    QFile::remove(getManifestPath());
+}
+
+/**
+ * @brief The server does not honour Range: stop all segments and fetch the file
+ * in one stream from the start. The host is remembered in the connection pool
+ * so later items for it do not try segments at all.
+ */
+void DownloadItem::collapseToSingleStream()
+{
+    qWarning() << "Downloading" << m_fileName << "in one stream, its server ignores Range requests";
+    if (m_pool) m_pool->markRangeUnsupported(m_mirrors.at(m_probeMirror).hostKey);
+    cleanup(false);
+    discardPartialData();
+    if (m_writeMode == DirectWrite) QFile::remove(m_fullFilePath); // Single stream appends to what is there
+    m_supportsRange = false;
+    m_isSingleChunk = true;
+    m_numChunks = 1;
+    m_speed.rebase(0);
+    emitProgress(true);
+    startSingleChunkDownload();
+}
+
+bool DownloadItem::rangeKnownUnsupported() const
+{
+    return m_pool && m_mirrors.size() > 0 && m_pool->isRangeUnsupported(m_mirrors.at(m_probeMirror).hostKey);
+}
+
+/**
+ * @brief The remote file changed mid-download: drop everything and start again
+ * with a fresh HEAD.
+ */
+void DownloadItem::restartFromScratch()
+{
+    qWarning() << m_fileName << "changed on the server, restarting from scratch";
+    cleanup(false);
+    discardPartialData();
+    m_etag.clear();
+    m_lastModified.clear();
+    m_speed.rebase(0);
+    emitProgress(true);
+    fetchTotalSize();
+}
+
+/**
+ * @brief Notes that progress changed. Changes are coalesced and published once
+ * per progress interval, so the number of queued signals does not grow with
+ * the read rate; force publishes at once (state changes, layout changes).
+ */
+void DownloadItem::emitProgress(bool force)
+{
+    if (force || !m_publishTimer) {
+        if (m_publishTimer) m_publishTimer->stop();
+        publishProgress();
+    } else if (!m_publishTimer->isActive()) {
+        m_publishTimer->start(m_progressIntervalMs);
+    }
+}
+
+/**
+ * @brief Creates what only a running download needs: the progress publisher.
+ * Rate samples come from the manager's tick(). Called on the item's thread
+ * when it starts or resumes.
+ */
+void DownloadItem::acquireRuntime()
+{
+    if (!m_publishTimer) {
+        m_publishTimer = new QTimer(this);
+        m_publishTimer->setSingleShot(true);
+        connect(m_publishTimer, &QTimer::timeout, this, &DownloadItem::publishProgress);
+    }
+    m_lastUpdateTime = QDateTime::currentMSecsSinceEpoch();
+    m_speed.rebase(m_downloadedSize);
+}
+
+/**
+ * @brief Drops the runtime timer once the item stops downloading, so an idle
+ * item has no wakeups. A pending publication goes out first.
+ */
+void DownloadItem::releaseRuntime()
+{
+    if (!m_publishTimer) return; // Never ran
+    if (runInOwnThread([this]() { if (m_state != Downloading) releaseRuntime(); })) return;
+    if (!m_publishTimer) return;
+    m_publishTimer->stop();
+    m_publishTimer->deleteLater(); // May be the sender of the slot we were called from
+    m_publishTimer = nullptr;
+    m_transferRate = 0;
+    {
+        QMutexLocker locker(&m_snapshotMutex);
+        m_snapshot.secondsLeft = -1;
+    }
+    publishProgress();
+}
+
+/**
+ * @brief Copies the item's counters into the snapshot other threads read and
+ * emits progress() once for the lot.
+ */
+void DownloadItem::publishProgress()
+{
+    {
+        QMutexLocker locker(&m_snapshotMutex);
+        m_snapshot.downloaded = m_downloadedSize;
+        m_snapshot.total = m_totalSize;
+        m_snapshot.rate = m_transferRate;
+        m_snapshot.segments.resize(m_segments.size());
+        for (int i = 0; i < m_segments.size(); ++i) m_snapshot.segments[i] = m_segments[i].downloaded;
+        m_onDisk.clear();
+        if (m_isSingleChunk) {
+            if (m_file && m_file->isOpen()) m_file->flush();
+            m_onDisk.append({0, m_downloadedSize});
+        } else if (m_writeMode == DirectWrite) {
+            for (const Segment &segment : std::as_const(m_segments)) {
+                if (segment.written > 0) m_onDisk.append({segment.start, segment.start + segment.written});
+            }
+        }
+    }
+    m_shownDownloaded.store(m_downloadedSize, std::memory_order_relaxed);
+    m_shownTotal.store(m_totalSize, std::memory_order_relaxed);
+    m_shownRate.store(m_transferRate, std::memory_order_relaxed);
+    emit progress(m_downloadedSize, m_totalSize > 0 ? m_totalSize : m_downloadedSize);
+}
+
+void DownloadItem::setProgressRate(int hz)
+{
+    if (runInOwnThread([this, hz]() { setProgressRate(hz); })) return;
+    m_progressIntervalMs = 1000 / qBound(1, hz, kMaxProgressRate);
+}
+
+DownloadItem::ProgressSnapshot DownloadItem::getProgressSnapshot() const
+{
+    QMutexLocker locker(&m_snapshotMutex);
+    ProgressSnapshot snapshot = m_snapshot;
+    snapshot.state = m_state;
+    // Set directly by loaders and the yt-dlp path without a publication
+    snapshot.downloaded = m_shownDownloaded.load(std::memory_order_relaxed);
+    snapshot.total = m_shownTotal.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+/**
+ * @brief Bytes from offset on that are in the target file, following written
+ * ranges that continue each other. Chunk files are not looked at, so in
+ * ChunkFiles mode nothing is available before the merge.
+ */
+qint64 DownloadItem::availableAt(qint64 offset) const
+{
+    if (m_state == Completed) return qMax<qint64>(0, getTotalSize() - offset);
+    QMutexLocker locker(&m_snapshotMutex);
+    qint64 position = offset;
+    for (bool extended = true; extended;) {
+        extended = false;
+        for (const auto &range : m_onDisk) {
+            if (range.first <= position && position < range.second) {
+                position = range.second;
+                extended = true;
+            }
+        }
+    }
+    return position - offset;
+}
+
+QList<qint64> DownloadItem::getSpeedHistory() const
+{
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_speedHistory;
+}
+
+int DownloadItem::getSegmentCount() const
+{
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_snapshot.segments.size();
 }
 
 qint64 DownloadItem::getChunkProgress(int chunkIndex) const {
-    if (chunkIndex < 0 || chunkIndex >= m_numChunks || !m_chunkProgress) return 0;
-    return m_chunkProgress[chunkIndex];
+    {
+        QMutexLocker locker(&m_snapshotMutex);
+        if (chunkIndex >= 0 && chunkIndex < m_snapshot.segments.size()) return m_snapshot.segments[chunkIndex];
+    }
+    // Never ran this session: spread what history says was downloaded evenly
+    if (chunkIndex < 0 || chunkIndex >= m_numChunks) return 0;
+    const qint64 downloaded = m_shownDownloaded.load(std::memory_order_relaxed);
+    if (downloaded <= 0 || m_shownTotal.load(std::memory_order_relaxed) <= 0) return 0;
+    const qint64 perChunk = downloaded / m_numChunks;
+    return chunkIndex == m_numChunks - 1 ? downloaded - perChunk * (m_numChunks - 1) : perChunk;
 }
 
 qint64 DownloadItem::getCurrentSpeedLimit()
@@ -737,10 +2622,16 @@ qint64 DownloadItem::getCurrentSpeedLimit()
 
 bool DownloadItem::validateChunk(int chunkIndex)
 {
-    if (chunkIndex < 0 || chunkIndex >= m_numChunks) return false;
-    QString chunkFileName = QString("%1.chunk%2").arg(m_fullFilePath).arg(chunkIndex);
-    QFile chunkFile(chunkFileName);
-    return chunkFile.exists() && chunkFile.size() == m_chunkDownloaded[chunkIndex];
+    if (chunkIndex < 0 || chunkIndex >= m_segments.size()) return false;
+    QFile chunkFile(chunkFilePath(chunkIndex));
+    return chunkFile.exists() && chunkFile.size() == m_segments[chunkIndex].written;
+}
+
+QString DownloadItem::chunkFilePath(int chunkIndex) const
+{
+    QString base = m_chunkDirectory.isEmpty() ? m_fullFilePath
+                                              : QDir(m_chunkDirectory).filePath(QFileInfo(m_fullFilePath).fileName());
+    return QString("%1.chunk%2").arg(base).arg(chunkIndex);
 }
 
 void DownloadItem::setFullFilePath(const QString &path)
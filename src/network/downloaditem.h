@@ -11,9 +11,21 @@
 #include <QMutex>
 #include <QThread>
 #include <QElapsedTimer>
+#include <atomic>
+#include "segmentfile.h"
+#include "connectioncontroller.h"
+#include "resumemanifest.h"
+#include "diskwriter.h"
+#include "checksum.h"
+#include "mirrorset.h"
+#include "speedmeter.h"
 
 // Forward declaration
-class SpeedLimitWorker;
+class ChunkMerger;
+class ConnectionPool;
+class NativeHttpClient;
+class RateLimiter;
+class MemoryBudget;
 
 class DownloadItem : public QObject
 {
@@ -21,6 +33,28 @@ class DownloadItem : public QObject
 public:
     enum State { Queued, Downloading, Paused, Stopped, Completed, Failed };
     Q_ENUM(State)
+    // DirectWrite: segments write in place into the preallocated target file.
+    // ChunkFiles: each segment goes to <file>.chunkN and is merged at the end.
+    enum WriteMode { DirectWrite, ChunkFiles };
+    Q_ENUM(WriteMode)
+    // QtNetwork: QNetworkAccessManager (at most 6 connections per host).
+    // NativeHttp: our own HTTP/1.1 client, one socket per segment, no host limit.
+    // Http2: QNetworkAccessManager with segments as streams on one HTTP/2
+    // connection; falls back to HTTP/1.1 when the server does not offer h2.
+    enum Transport { QtNetwork, NativeHttp, Http2 };
+    Q_ENUM(Transport)
+    // Outcome of comparing the finished file against the expected checksum
+    enum Integrity { Unchecked, Verified, Corrupt };
+    Q_ENUM(Integrity)
+    // Progress as last published: one consistent view for the GUI and statistics
+    struct ProgressSnapshot {
+        State state = Queued;
+        qint64 downloaded = 0;
+        qint64 total = -1;
+        qint64 rate = 0;        // Smoothed bytes/s
+        qint64 secondsLeft = -1; // From the recent rate; -1 while unknown
+        QList<qint64> segments; // Bytes received per segment
+    };
 
     explicit DownloadItem(const QUrl &url, const QString &filePath, QObject *parent = nullptr);
     ~DownloadItem();
@@ -29,43 +63,93 @@ public:
     void pause();
     void resume();
     void stop();
+    // Once-a-second sample, driven by the DownloadManager for active items only
+    void tick();
 
     // --- Setters ---
     void setState(State state);
     void setProxy(const QNetworkProxy &proxy);
-    void setSpeedLimit(qint64 bytesPerSec);
+    void setSpeedLimit(qint64 bytesPerSec); // This item only; global and per-host limits live in the RateLimiter
+    void setRateLimiter(RateLimiter *limiter);
+    void setMemoryBudget(MemoryBudget *budget);
+    void setDiskWriterPool(DiskWriterPool *pool);
     void setFileName(const QString &name) { m_fileName = name; }
     void setNumChunks(int num);
     void setUrl(const QUrl &url) { m_url = url; }
     void setLastTryDate(const QDateTime &date) { m_lastTryDate = date; }
     void setDescription(const QString &desc) { m_description = desc; }
-    void setTotalSize(qint64 size) { m_totalSize = size; }
-    void setDownloadedSize(qint64 size) { m_downloadedSize = size; }
+    void setTotalSize(qint64 size) { m_totalSize = size; m_shownTotal.store(size, std::memory_order_relaxed); }
+    void setDownloadedSize(qint64 size) { m_downloadedSize = size; m_shownDownloaded.store(size, std::memory_order_relaxed); }
     void setFullFilePath(const QString &path);
+    void setWriteMode(WriteMode mode);
+    void setChunkDirectory(const QString &dir);
+    void setMaxConnections(int max);
+    void setConnectionPool(ConnectionPool *pool);
+    // chosen: picked for this item; otherwise the manager's default, which it may replace
+    void setTransport(Transport transport, bool chosen = true);
+    // Start new downloads with a GET for bytes=0- instead of a HEAD round trip
+    void setFastStart(bool enabled);
+    void setProgressRate(int hz); // Progress publications per second
+    // A request that delivers nothing for this long is reconnected
+    void setStallTimeout(int seconds);
+    // Transient errors a run may retry before the item fails
+    void setMaxRetries(int retries);
+    // For very large files: keep written data out of the page cache and write
+    // it back steadily, so the download does not evict everything else. A
+    // segmented download is then not checked against a SHA or MD5 digest:
+    // hashing it would read most of the file back from disk (see catchUpHash())
+    void setLargeFileMode(bool enabled);
+    void setExpectedChecksum(const Checksum &checksum);
+    void setChecksumUrl(const QUrl &url); // A .sha256 / .sha1 / .md5 file fetched before the download
+    // More sources for the same file, besides the URL; segments are spread across all of them
+    void setMirrors(const QList<QUrl> &urls);
+    // Media: the start and end of the file first, then in offset order from the
+    // playback position, so it can be played while it downloads
+    void setSequential(bool enabled);
+    void setStreamPosition(qint64 offset); // Where the player reads; that range is fetched first
 
     // --- Getters ---
     State getState() const { return m_state; }
     QUrl getUrl() const { return m_url; }
+    QList<QUrl> getMirrors() const;
     QString getFileName() const { return m_fileName; }
     QString getFullFilePath() const { return m_fullFilePath; }
-    qint64 getTotalSize() const { return m_totalSize; }
-    qint64 getDownloadedSize() const { return m_downloadedSize; }
-    qint64 getTransferRate() const { return m_transferRate; }
+    // Published values, safe from any thread
+    qint64 getTotalSize() const { return m_shownTotal.load(std::memory_order_relaxed); }
+    qint64 getDownloadedSize() const { return m_shownDownloaded.load(std::memory_order_relaxed); }
+    qint64 getTransferRate() const { return m_shownRate.load(std::memory_order_relaxed); }
+    ProgressSnapshot getProgressSnapshot() const;
+    QList<qint64> getSpeedHistory() const; // Bytes/s per tick, oldest first
+    // Disk space still to be claimed on the target volume; 0 while the size is unknown
+    qint64 spaceNeeded() const;
+    // Bytes in the file from offset on, without a gap, as last published
+    qint64 availableAt(qint64 offset) const;
+    bool isSequential() const { return m_sequential; }
     qint64 getCurrentSpeedLimit();
     QDateTime getLastTryDate() const { return m_lastTryDate; }
     qint64 getChunkProgress(int chunkIndex) const;
     QString getDescription() const { return m_description; }
     int getNumChunks() const { return m_numChunks; }
+    int getSegmentCount() const;
     bool isSingleChunk() const { return m_isSingleChunk; }
-
-    // Friend declaration to allow SpeedLimitWorker access to private members
-    friend class SpeedLimitWorker;
+    WriteMode getWriteMode() const { return m_writeMode; }
+    QString getChunkDirectory() const { return m_chunkDirectory; } // Set before the item is queued
+    Transport getTransport() const { return m_transport; }
+    bool isTransportChosen() const { return m_transportChosen; }
+    QString chunkFilePath(int chunkIndex) const;
+    QString getManifestPath() const { return ResumeManifest::pathFor(m_fullFilePath); }
+    Checksum getExpectedChecksum() const;
+    Checksum getActualChecksum() const; // Set once the download completes
+    Integrity getIntegrity() const { return m_integrity; }
 
 signals:
     void progress(qint64 bytesReceived, qint64 bytesTotal);
     void finished();
     void failed(const QString &reason);
     void stateChanged(State state);
+    void mergeProgress(qint64 bytesMerged, qint64 bytesTotal);
+    // The volume cannot take the rest of the file; the item went back to Queued
+    void spaceShortage(qint64 needed, qint64 available);
 
 private slots:
     void onHeadFinished();
@@ -73,24 +157,105 @@ private slots:
     void onChunkFinished(int chunkIndex);
     void onError(QNetworkReply::NetworkError code);
     void updateTransferRate();
-    void fetchSizeWithGet();
-    void onGetReadyRead();
-    void onGetFinished();
+    void onMergeFinished(bool ok, const QString &error);
+    void resumeReading();
+    void onWritesCompleted();
+    void onChecksumFileFinished();
+    void onProbeResponse();
+    void onHedgeReadyRead(int chunkIndex);
+    void onHedgeFinished(int chunkIndex);
+    void hashCatchUp();
+    void publishProgress();
 
 private:
-    void enforceSpeedLimit(qint64 bytesToRead);
+    void configureReply(QNetworkReply *reply);
+    qint64 reserveRead(QNetworkReply *reply, qint64 wanted, const QString &host);
+    void finishRead(qint64 reserved);
+    DiskWriter *diskWriter();
+    void flushSegment(int chunkIndex);
+    bool collectWrites(QString *error);
+    void drainWrites(bool discardPending);
+    void fetchChecksumFile();
+    bool canFastStart() const;
+    void sendProbe();
+    bool attachSegmentReply(int chunkIndex, QNetworkReply *reply, int mirror);
+    void connectSegmentReply(int chunkIndex, QNetworkReply *reply);
+    qint64 readSegmentData(int chunkIndex, QNetworkReply *reply, qint64 *position, const QString &host);
+    void hedgeTail();
+    bool startHedge(int chunkIndex);
+    void promoteHedge(int chunkIndex);
+    void dropHedge(int chunkIndex);
+    void resetStalledSegments();
+    void takeChecksumFromHeaders(const QNetworkReply *reply, bool partialContent = false);
+    void ensureHasher();
+    void resetHash();
+    bool catchUpHash(qint64 budget);
+    bool hashFilePrefix(qint64 length);
+    qint64 readSegment(int chunkIndex, qint64 offset, char *data, qint64 len);
+    Checksum combinedSegmentCrc(bool readInvalid);
+    bool verifyIntegrity();
+    bool checkIntegrity(const Checksum &actual);
+    void finishSegments();
     void fetchTotalSize();
     void startChunkDownloads();
     void cleanup(bool deleteFiles);
     bool checkPartialChunks();
     void initializeChunks();
     void mergeChunks();
+    bool openOutputFile();
+    void finishDirectWrite();
+    void stopMergeThread();
     void startOrResumeChunk(int chunkIndex);
-    void startSingleChunkDownload();
+    void startSegments();
+    bool startNextSegment();
+    bool splitLargestSegment();
+    qint64 streamPieceSize() const;
+    int streamTier(qint64 start, qint64 end) const;
+    void cutIntoPieces();
+    void completeSegment(int chunkIndex);
+    void releaseSegment(int chunkIndex);
+    void adjustConnections(bool sample);
+    void resetMirrors();
+    QList<int> mirrorLoad() const;
+    QString segmentHostKey(int chunkIndex) const;
+    QString segmentHost(int chunkIndex) const; // Host name, for host speed limits
+    bool failMirror(int chunkIndex, bool permanent);
+    void retrySegment(int chunkIndex, qint64 retryAfterMs, const QString &reason);
+    void failWithError(const QString &reason);
+    int activeSegmentCount() const;
+    bool allSegmentsComplete() const;
+    bool validateSegmentResponse(int chunkIndex);
+    QByteArray ifRangeValue() const;
+    void saveManifest();
+    void restoreManifest();
+    void discardPartialData();
+    void restartFromScratch();
+    void collapseToSingleStream();
+    bool rangeKnownUnsupported() const;
+    qint64 spaceNeededFor(qint64 total, qint64 downloaded) const;
+    bool ensureFreeSpace();
+    void startSingleChunkDownload(QNetworkReply *probe = nullptr);
+    void emitProgress(bool force = false);
+    void acquireRuntime();
+    void releaseRuntime();
+    // Queues f onto the item's thread when called from another one (e.g. the GUI)
+    template <typename Func>
+    bool runInOwnThread(Func f)
+    {
+        if (QThread::currentThread() == thread()) return false;
+        QMetaObject::invokeMethod(this, f, Qt::QueuedConnection);
+        return true;
+    }
     void onSingleChunkReadyRead();
     void onSingleChunkFinished();
 
     QNetworkRequest createNetworkRequest(const QUrl &url);
+    QNetworkAccessManager *networkManager();
+    NativeHttpClient *nativeClient();
+    void releaseNetworkManager();
+    bool usesHostSlots() const { return m_pool && m_transport != Http2; }
+    QNetworkReply *sendGet(const QNetworkRequest &request);
+    QNetworkReply *sendHead(const QNetworkRequest &request);
     qint64 m_lastUpdateTime;
     QUrl m_url;
     QFile *m_file;
@@ -98,49 +263,112 @@ private:
     QString m_fullFilePath;
     qint64 m_totalSize;
     qint64 m_downloadedSize;
-    State m_state;
+    std::atomic<State> m_state; // Written on the item's thread, read from any
 
-    QNetworkAccessManager *m_manager;
+    QNetworkAccessManager *m_manager;       // Own manager, only used without a pool
+    ConnectionPool *m_pool = nullptr;
+    QNetworkAccessManager *m_sharedManager = nullptr; // Borrowed from m_pool while downloading
+    std::atomic<Transport> m_transport{QtNetwork};
+    std::atomic<bool> m_transportChosen{false};
+    NativeHttpClient *m_nativeClient = nullptr;       // Own client, only used without a pool
+    NativeHttpClient *m_sharedNativeClient = nullptr; // Borrowed from m_pool while downloading
+    QString m_hostKey;
+    QString m_host; // m_url's host name, lower case
+    QNetworkProxy m_proxy;
+    bool m_http2Checked = false;
+    bool m_fastStart = true;
+    bool m_probeFailed = false; // The fast-start GET was refused, use HEAD this run
+    bool m_singleResponseChecked = false;
+    qint64 m_singleActivity = 0; // On m_clock, last data of the single stream
+    QElapsedTimer m_clock;
+    int m_stallTimeoutMs = 20000;
+    int m_maxRetries = 30;
+    int m_errorCount = 0;   // Retries spent this run
+    int m_singleRetries = 0; // Failed single-stream requests in a row
+    bool m_largeFileMode = false;
+    std::atomic<bool> m_sequential{false};
+    qint64 m_streamPosition = 0;
+    SegmentFile::Writeback m_singleWriteback; // Single-stream ranges for SegmentFile::writeBack()
     QNetworkReply *m_reply;
 
     int m_numChunks;
     bool m_supportsRange;
-    bool m_isSingleChunk;
-    QList<qint64> m_chunks;
-    QList<QNetworkReply*> m_chunkReplies;
-    QList<QFile*> m_chunkFiles;
-    QList<qint64> m_chunkDownloaded;
+    std::atomic<bool> m_isSingleChunk;
+    // A byte range served by one connection. Ranges are split while downloading,
+    // so segments are only ever appended and their index doubles as chunk number.
+    struct Segment {
+        qint64 start = 0;
+        qint64 end = 0;           // Exclusive
+        qint64 downloaded = 0;    // Bytes received from start
+        qint64 written = 0;       // Of those, bytes the disk writer has put in the file
+        qint64 requestOffset = 0; // downloaded when the current request was sent
+        QNetworkReply *reply = nullptr;
+        SegmentFile *file = nullptr; // ChunkFiles mode only
+        DiskBuffer pending;       // Received, not yet handed to the disk writer
+        qint64 pendingOffset = 0; // File offset of pending
+        quint32 crc = 0;          // CRC-32C of the first downloaded bytes
+        bool crcValid = true;     // false when those bytes came from an earlier session
+        int mirror = -1;          // Index in m_mirrors of the current request
+        qint64 sampledBytes = 0;  // downloaded at the last throughput sample
+        qint64 rate = 0;          // Bytes/s over the last tick
+        qint64 replyPosition = 0; // Bytes from start the current request has delivered
+        qint64 requestTime = 0;   // On m_clock
+        qint64 lastActivity = 0;  // On m_clock, last time the segment advanced
+        // End game: a second request racing the first one for the same bytes
+        QNetworkReply *hedge = nullptr;
+        int hedgeMirror = -1;
+        qint64 hedgeOffset = 0;   // downloaded when the hedge was sent
+        qint64 hedgePosition = 0;
+        qint64 hedgeGain = 0;     // Bytes each request added since the hedge was sent
+        qint64 primaryGain = 0;
+        int retries = 0;          // Failed requests in a row, for the backoff
+        qint64 retryAt = 0;       // On m_clock; not restarted before that
+        qint64 length() const { return end - start; }
+        qint64 remaining() const { return end - start - downloaded; }
+    };
+    QList<Segment> m_segments;
+    ConnectionController m_connections;
+    std::atomic<WriteMode> m_writeMode{DirectWrite};
+    SegmentFile *m_outputFile = nullptr;
+    QString m_chunkDirectory; // Empty: chunk files sit next to the target
+    ChunkMerger *m_merger = nullptr;
+    QThread *m_mergeThread = nullptr;
+    QByteArray m_etag;         // Validators from the last HEAD, checked on resume
+    QByteArray m_lastModified;
+    QUrl m_checksumUrl;
+    QList<QUrl> m_mirrorUrls; // Written under m_snapshotMutex, read by the GUI
+    MirrorSet m_mirrors;      // m_url first, then m_mirrorUrls
+    int m_probeMirror = 0;    // Mirror that answered the HEAD; the validators are its own
+    Checksum m_expectedChecksum; // Written under m_snapshotMutex, read by the GUI
+    Checksum m_actualChecksum;
+    std::atomic<Integrity> m_integrity{Unchecked}; // Written on the item's thread, read by the GUI
+    StreamHasher *m_hasher = nullptr; // Whole-file hash, fed in file order
+    bool m_hashCatchUpQueued = false;
 
-    QTimer *m_rateTimer;
-    qint64 m_bytesLastPeriod;
+    QTimer *m_publishTimer = nullptr; // Coalesces progress into one publication per interval
+    int m_progressIntervalMs = 100;
+    // Progress as last published and the checksums, read from the GUI thread
+    mutable QMutex m_snapshotMutex;
+    ProgressSnapshot m_snapshot;
+    QList<QPair<qint64, qint64>> m_onDisk; // Written byte ranges, [first, end)
+    std::atomic<qint64> m_shownDownloaded{0};
+    std::atomic<qint64> m_shownTotal{-1};
+    std::atomic<qint64> m_shownRate{0};
+    SpeedMeter m_speed;
+    QList<qint64> m_speedHistory; // Copy of m_speed's, under m_snapshotMutex
     qint64 m_transferRate;
 
     qint64 m_speedLimit = 0;
-    qint64 m_bytesReadThisSecond = 0;
-    QElapsedTimer m_speedLimitTimer;
     QMutex m_speedLimitMutex;
-    SpeedLimitWorker* m_worker = nullptr;
-    QThread* m_workerThread = nullptr;
+    RateLimiter *m_limiter = nullptr;
+    MemoryBudget *m_budget = nullptr; // Caps bytes held between socket and disk
+    DiskWriterPool *m_diskWriters = nullptr;
+    DiskWriter *m_writer = nullptr;    // Writer for the target's volume while files are open
+    DiskWriter *m_ownWriter = nullptr; // Only used without a pool
     QDateTime m_lastTryDate;
     QString m_description;
     QMutex m_chunkMutex;
     bool validateChunk(int chunkIndex);
-    qint64* m_chunkProgress;
-};
-
-// Definition of SpeedLimitWorker outside DownloadItem
-class SpeedLimitWorker : public QObject {
-    Q_OBJECT
-public:
-    explicit SpeedLimitWorker(DownloadItem* parent);
-    ~SpeedLimitWorker();
-
-public slots:
-    void enforceLimit(qint64 bytesToRead);
-
-private:
-    DownloadItem* m_parent;
-    QElapsedTimer* m_timer;
 };
 
 #endif // DOWNLOADITEM_H
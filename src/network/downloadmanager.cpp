@@ -3,12 +3,15 @@
 #include <QProcess>
 #include <QRegularExpression>
 #include <QDir>
+#include <QStorageInfo>
 #include <QTime>
 #include "../utils/utils.h"
 
 DownloadManager::DownloadManager(QObject *parent)
-    : QObject(parent), m_maxConcurrentDownloads(3), m_globalSpeedLimit(0), m_speedLimitEnabled(false)
+    : QObject(parent), m_maxConcurrentDownloads(3), m_connectionPool(new ConnectionPool(this)),
+    m_rateLimiter(new RateLimiter(this)), m_globalSpeedLimit(0), m_speedLimitEnabled(false)
 {
+    connect(&m_tickTimer, &QTimer::timeout, this, &DownloadManager::tick);
 }
 
 DownloadManager::~DownloadManager()
@@ -16,32 +19,104 @@ DownloadManager::~DownloadManager()
     stopAll();
     qDeleteAll(m_downloadQueue);
     m_downloadQueue.clear();
+    // Let items still on the workers die there while the connection pool is alive
+    m_workers.shutdown();
+    // Pooled managers own replies counted by m_memoryBudget, so go before it does
+    delete m_connectionPool;
+    m_connectionPool = nullptr;
 }
 
 void DownloadManager::addToQueue(DownloadItem *item)
 {
     if (!item || m_downloadQueue.contains(item) || m_activeDownloads.contains(item)) return;
 
+    // Items are created on the GUI thread; their transfers belong on a worker
+    if (item->thread() == thread()) {
+        if (!item->isTransportChosen()) item->setTransport(m_defaultTransport, false); // Decides the worker below
+        const bool shareOrigin = m_shareHttp2Connections && item->getTransport() == DownloadItem::Http2;
+        m_workers.adopt(item, shareOrigin ? ConnectionPool::hostKey(item->getUrl()) : QString());
+    }
     m_downloadQueue.append(item);
     emit queueStatusChanged(m_activeDownloads.size(), m_downloadQueue.size());
     startNextInQueue();
 }
 
+void DownloadManager::resumeItem(DownloadItem *item)
+{
+    if (!item) return;
+    if (m_activeDownloads.contains(item)) {
+        item->resume(); // Paused on its own; already on a worker with its settings
+    } else if (m_downloadQueue.contains(item)) {
+        startNextInQueue();
+    } else {
+        addToQueue(item); // From history: adopted and configured before it starts
+    }
+}
+
+/**
+ * @brief Starts queued items while slots are free. An item whose size is known
+ * only starts if its volume has room for it on top of what the active items on
+ * that volume still need; otherwise it is held and the next one is tried.
+ */
 void DownloadManager::startNextInQueue()
 {
-    while (m_activeDownloads.size() < m_maxConcurrentDownloads && !m_downloadQueue.isEmpty()) {
-        DownloadItem *item = m_downloadQueue.takeFirst();
-        if (item) {
-            m_activeDownloads.append(item);
-            connect(item, &DownloadItem::finished, this, &DownloadManager::handleItemFinishedOrFailed);
-            connect(item, &DownloadItem::failed, this, &DownloadManager::handleItemFinishedOrFailed);
-            applySettingsToItem(item);
-            item->start();
+    QHash<QString, qint64> committed; // Volume root -> space active items still claim
+    for (DownloadItem *item : std::as_const(m_activeDownloads)) {
+        const qint64 needed = item->spaceNeeded();
+        if (needed > 0) committed[SegmentFile::volumeOf(item->getFullFilePath()).rootPath()] += needed;
+    }
+
+    for (int i = 0; i < m_downloadQueue.size() && m_activeDownloads.size() < m_maxConcurrentDownloads;) {
+        DownloadItem *item = m_downloadQueue.at(i);
+        if (!item) {
+            m_downloadQueue.removeAt(i);
+            continue;
         }
+        const qint64 needed = item->spaceNeeded();
+        if (needed > 0) {
+            const QStorageInfo volume = SegmentFile::volumeOf(item->getFullFilePath());
+            qint64 &claimed = committed[volume.rootPath()];
+            if (volume.isValid() && claimed + needed > volume.bytesAvailable()) {
+                if (!m_heldForSpace.contains(item)) {
+                    m_heldForSpace.insert(item);
+                    const QString reason = QString("Waiting for disk space on %1: %2 needed, %3 free")
+                                               .arg(volume.rootPath(), formatSize(claimed + needed), formatSize(volume.bytesAvailable()));
+                    qWarning() << item->getFileName() << reason;
+                    emit itemHeld(item, reason);
+                }
+                ++i;
+                continue;
+            }
+            claimed += needed;
+        }
+        m_heldForSpace.remove(item);
+        m_downloadQueue.removeAt(i);
+        m_activeDownloads.append(item);
+        connect(item, &DownloadItem::finished, this, &DownloadManager::handleItemFinishedOrFailed);
+        connect(item, &DownloadItem::failed, this, &DownloadManager::handleItemFinishedOrFailed);
+        connect(item, &DownloadItem::spaceShortage, this, &DownloadManager::handleItemSpaceShortage);
+        applySettingsToItem(item);
+        item->start();
     }
+    if ((!m_activeDownloads.isEmpty() || !m_heldForSpace.isEmpty()) && !m_tickTimer.isActive()) m_tickTimer.start(1000);
     emit queueStatusChanged(m_activeDownloads.size(), m_downloadQueue.size());
 }
 
+/**
+ * @brief One rate sample for every active item. A single timer here replaces a
+ * timer per item, and queued or finished items are not woken at all. Items
+ * held for disk space are looked at again, in case room was made meanwhile.
+ */
+void DownloadManager::tick()
+{
+    if (m_activeDownloads.isEmpty() && m_heldForSpace.isEmpty()) {
+        m_tickTimer.stop();
+        return;
+    }
+    for (DownloadItem *item : std::as_const(m_activeDownloads)) item->tick();
+    if (!m_heldForSpace.isEmpty() && m_activeDownloads.size() < m_maxConcurrentDownloads) startNextInQueue();
+}
+
 void DownloadManager::pauseAll()
 {
     qDebug() << "Pausing all downloads. Active count:" << m_activeDownloads.size();
@@ -66,6 +141,7 @@ void DownloadManager::stopAll()
     m_activeDownloads.clear();
     for (DownloadItem *item : m_downloadQueue) item->stop();
     m_downloadQueue.clear();
+    m_heldForSpace.clear();
     emit queueStatusChanged(0, 0);
 }
 
@@ -75,6 +151,7 @@ void DownloadManager::handleItemFinishedOrFailed()
     if (item) {
         disconnect(item, &DownloadItem::finished, this, &DownloadManager::handleItemFinishedOrFailed);
         disconnect(item, &DownloadItem::failed, this, &DownloadManager::handleItemFinishedOrFailed);
+        disconnect(item, &DownloadItem::spaceShortage, this, &DownloadManager::handleItemSpaceShortage);
         m_activeDownloads.removeOne(item);
 
         if (item->getState() != DownloadItem::Completed) m_downloadQueue.prepend(item);
@@ -83,11 +160,38 @@ void DownloadManager::handleItemFinishedOrFailed()
     }
 }
 
+/**
+ * @brief An item learnt its size only after it started and the volume has no
+ * room for it: it goes back to the front of the queue, held like one that was
+ * refused before starting, and its slot goes to the next item.
+ */
+void DownloadManager::handleItemSpaceShortage(qint64 needed, qint64 available)
+{
+    DownloadItem *item = qobject_cast<DownloadItem*>(sender());
+    if (!item || !m_activeDownloads.removeOne(item)) return;
+    disconnect(item, &DownloadItem::finished, this, &DownloadManager::handleItemFinishedOrFailed);
+    disconnect(item, &DownloadItem::failed, this, &DownloadManager::handleItemFinishedOrFailed);
+    disconnect(item, &DownloadItem::spaceShortage, this, &DownloadManager::handleItemSpaceShortage);
+    m_downloadQueue.prepend(item);
+    m_heldForSpace.insert(item);
+    const QString reason = QString("Waiting for disk space on %1: %2 needed, %3 free")
+                               .arg(SegmentFile::volumeOf(item->getFullFilePath()).rootPath(), formatSize(needed), formatSize(available));
+    qWarning() << item->getFileName() << reason;
+    emit itemHeld(item, reason);
+    startNextInQueue();
+}
+
 void DownloadManager::applySettingsToItem(DownloadItem *item)
 {
     if (item) {
         item->setProxy(m_proxy);
-        item->setSpeedLimit(m_speedLimitEnabled ? m_globalSpeedLimit : 0);
+        item->setConnectionPool(m_connectionPool);
+        item->setRateLimiter(m_rateLimiter);
+        item->setMemoryBudget(&m_memoryBudget);
+        item->setDiskWriterPool(&m_diskWriters);
+        item->setProgressRate(m_progressRate);
+        item->setLargeFileMode(m_largeFileMode);
+        if (!item->isTransportChosen()) item->setTransport(m_defaultTransport, false);
     }
 }
 
@@ -166,14 +270,34 @@ void DownloadManager::setGlobalSpeedLimit(qint64 bytesPerSec, bool enabled)
 {
     m_globalSpeedLimit = bytesPerSec;
     m_speedLimitEnabled = enabled;
-    for (DownloadItem *item : m_activeDownloads) {
-        if (item) { // Guard against null items
-            applySettingsToItem(item);
-            if (item->getState() == DownloadItem::Downloading) {
-                item->setSpeedLimit(m_speedLimitEnabled ? m_globalSpeedLimit : 0);
-            }
-        }
-    }
+    // One bucket shared by every download, so the cap holds for the total
+    m_rateLimiter->setGlobalRate(m_speedLimitEnabled ? m_globalSpeedLimit : 0);
+}
+
+void DownloadManager::setMemoryBudget(qint64 bytes)
+{
+    // Shrinking only takes effect as items write out what they already hold
+    m_memoryBudget.setCapacity(bytes);
+}
+
+void DownloadManager::setProgressRate(int hz)
+{
+    m_progressRate = qMax(1, hz);
+    for (DownloadItem *item : m_activeDownloads) item->setProgressRate(m_progressRate);
+}
+
+void DownloadManager::setLargeFileMode(bool enabled)
+{
+    // Taken up by items as they (re)open their files
+    m_largeFileMode = enabled;
+}
+
+void DownloadManager::setHostSpeedLimit(const QString &host, qint64 bytesPerSec)
+{
+    // A URL or "host:port" works too; the limit covers every scheme and port of the host
+    const QString name = QUrl(host.contains("://") ? host : "http://" + host).host().toLower();
+    if (name.isEmpty()) return;
+    m_rateLimiter->setHostRate(name, bytesPerSec);
 }
 
 bool DownloadManager::isItemActive(DownloadItem *item) const
@@ -4,7 +4,13 @@
 #include <QObject>
 #include <QNetworkProxy>
 #include <QList>
+#include <QSet>
 #include "downloaditem.h"
+#include "networkworkerpool.h"
+#include "connectionpool.h"
+#include "ratelimiter.h"
+#include "memorybudget.h"
+#include "diskwriter.h"
 
 class DownloadManager : public QObject
 {
@@ -15,33 +21,63 @@ public:
 
     // --- Public API ---
     void addToQueue(DownloadItem *item);
+    // A paused item: resumed in place if it still holds a slot, queued otherwise
+    void resumeItem(DownloadItem *item);
     void pauseAll();
     void resumeAll();
     void stopAll();
     void setMaxConcurrentDownloads(int max);
     void setProxy(const QNetworkProxy &proxy);
+    void setMaxConnectionsPerHost(int max) { m_connectionPool->setMaxConnectionsPerHost(max); }
+    // HTTP/2 items to the same origin share one connection (they must share a thread for that)
+    void setShareHttp2Connections(bool share) { m_shareHttp2Connections = share; }
+    // Transport of items that have none chosen for themselves
+    void setDefaultTransport(DownloadItem::Transport transport) { m_defaultTransport = transport; }
+    DownloadItem::Transport defaultTransport() const { return m_defaultTransport; }
     bool isItemActive(DownloadItem *item) const;
     int getQueuePosition(DownloadItem *item) const;
     // *** FIX: Re-added for compatibility with MainWindow UI ***
     void setGlobalSpeedLimit(qint64 bytesPerSec, bool enabled);
+    void setHostSpeedLimit(const QString &host, qint64 bytesPerSec);
+    // Data held in memory by all downloads together (reply buffers and unwritten reads)
+    void setMemoryBudget(qint64 bytes);
+    // How often items publish progress to the GUI, per second
+    void setProgressRate(int hz);
+    // Keep downloads out of the page cache (see DownloadItem::setLargeFileMode())
+    void setLargeFileMode(bool enabled);
     void downloadYouTube(DownloadItem *item);
     void downloadYouTubeWithOptions(DownloadItem *item, const QStringList &args);
 
 signals:
     void queueStatusChanged(int activeCount, int queuedCount);
+    // The item stays queued until its volume has room for it
+    void itemHeld(DownloadItem *item, const QString &reason);
 
 private slots:
     void handleItemFinishedOrFailed();
+    void handleItemSpaceShortage(qint64 needed, qint64 available);
     void processQueue();
+    void tick();
 
 private:
     void startNextInQueue();
     void applySettingsToItem(DownloadItem *item);
     QTimer m_processTimeout;
+    QTimer m_tickTimer; // Samples the active items once a second; stopped while none are
     QList<DownloadItem*> m_downloadQueue;
     QList<DownloadItem*> m_activeDownloads;
+    QSet<DownloadItem*> m_heldForSpace; // Queued items whose volume is too full
     int m_maxConcurrentDownloads;
     QNetworkProxy m_proxy;
+    NetworkWorkerPool m_workers; // Queued items run on these threads, not the GUI one
+    ConnectionPool *m_connectionPool; // Lent to every item so keep-alive connections are shared
+    bool m_shareHttp2Connections = true;
+    DownloadItem::Transport m_defaultTransport = DownloadItem::QtNetwork;
+    int m_progressRate = 10;
+    bool m_largeFileMode = false;
+    RateLimiter *m_rateLimiter; // Global, per-host and per-item token buckets
+    MemoryBudget m_memoryBudget;
+    DiskWriterPool m_diskWriters; // One write-behind thread per volume
     // Members to store the global speed limit state
     qint64 m_globalSpeedLimit;
     bool m_speedLimitEnabled;
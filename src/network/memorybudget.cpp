@@ -0,0 +1,75 @@
+#include "memorybudget.h"
+#include <QNetworkReply>
+
+namespace {
+constexpr qint64 kMinReplyBuffer = 64 * 1024;
+constexpr qint64 kMaxReplyBuffer = 4 * 1024 * 1024;
+}
+
+MemoryBudget::MemoryBudget(qint64 capacity)
+    : m_capacity(qMax<qint64>(kMinReplyBuffer, capacity))
+{
+}
+
+void MemoryBudget::setCapacity(qint64 bytes)
+{
+    m_capacity.storeRelaxed(qMax<qint64>(kMinReplyBuffer, bytes));
+    wakeWaiters();
+}
+
+qint64 MemoryBudget::acquire(QObject *owner, qint64 wanted)
+{
+    if (wanted <= 0) return 0;
+    QMutexLocker locker(&m_mutex);
+    qint64 granted = qMin(wanted, capacity() - used());
+    if (granted <= 0) {
+        m_waiting.insert(owner);
+        return 0;
+    }
+    m_used.fetchAndAddRelaxed(granted);
+    return granted;
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    if (bytes <= 0) return;
+    m_used.fetchAndAddRelaxed(-bytes);
+    wakeWaiters();
+}
+
+void MemoryBudget::removeOwner(QObject *owner)
+{
+    QMutexLocker locker(&m_mutex);
+    m_waiting.remove(owner);
+}
+
+/**
+ * @brief Posted under the lock so an owner being destroyed (which blocks in
+ * removeOwner()) never receives a call after it is gone.
+ */
+void MemoryBudget::wakeWaiters()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_waiting.isEmpty() || used() >= capacity()) return;
+    for (QObject *owner : std::as_const(m_waiting)) {
+        QMetaObject::invokeMethod(owner, "resumeReading", Qt::QueuedConnection);
+    }
+    m_waiting.clear();
+}
+
+qint64 MemoryBudget::trackReply(QNetworkReply *reply)
+{
+    m_replies.fetchAndAddRelaxed(1);
+    QObject::connect(reply, &QObject::destroyed, [this]() { m_replies.fetchAndAddRelaxed(-1); });
+    return replyBufferSize();
+}
+
+/**
+ * @brief Half of the budget is shared out as reply read buffers, the rest is
+ * left for data waiting to be written.
+ */
+qint64 MemoryBudget::replyBufferSize() const
+{
+    const qint64 replies = qMax(1, m_replies.loadRelaxed());
+    return qBound(kMinReplyBuffer, capacity() / (2 * replies), kMaxReplyBuffer);
+}
@@ -0,0 +1,48 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+
+class QNetworkReply;
+
+/**
+ * @brief Upper bound on download data held in memory across all items.
+ *
+ * Covers both the network side (each reply's read buffer gets a share of the
+ * budget, so an unread reply stops pulling from its socket) and data read
+ * but not yet on disk (reserved with acquire(), returned with release()).
+ * An item that cannot reserve anything stops reading and is woken through
+ * its resumeReading() slot once memory is released.
+ */
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(qint64 capacity = 256 * 1024 * 1024);
+
+    void setCapacity(qint64 bytes);
+    qint64 capacity() const { return m_capacity.loadRelaxed(); }
+    qint64 used() const { return m_used.loadRelaxed(); }
+
+    // Thread-safe. Grants up to wanted bytes (possibly 0; owner is woken later)
+    qint64 acquire(QObject *owner, qint64 wanted);
+    void release(qint64 bytes);
+    void removeOwner(QObject *owner);
+
+    // Counts the reply until it is destroyed and returns its read buffer size
+    qint64 trackReply(QNetworkReply *reply);
+    qint64 replyBufferSize() const;
+
+private:
+    void wakeWaiters();
+
+    QAtomicInteger<qint64> m_capacity;
+    QAtomicInteger<qint64> m_used = 0;
+    QAtomicInt m_replies = 0;
+    QMutex m_mutex;
+    QSet<QObject*> m_waiting;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,91 @@
+#include "metalink.h"
+#include <QFileInfo>
+#include <QXmlStreamReader>
+#include <algorithm>
+
+namespace {
+constexpr int kNoPriority = 999999; // Lowest Metalink 4 priority
+
+int rank(Checksum::Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Checksum::Sha256: return 3;
+    case Checksum::Sha1: return 2;
+    case Checksum::Md5: return 1;
+    default: return 0;
+    }
+}
+
+// Metalink 4 "priority" runs from 1 (best) up; 3.0 "preference" from 100 (best) down
+int urlPriority(const QXmlStreamAttributes &attributes)
+{
+    if (attributes.hasAttribute("preference")) return 101 - attributes.value("preference").toInt();
+    if (attributes.hasAttribute("priority")) return attributes.value("priority").toInt();
+    return kNoPriority;
+}
+}
+
+bool Metalink::parse(const QByteArray &xml)
+{
+    m_files.clear();
+    m_errorString.clear();
+
+    QXmlStreamReader reader(xml);
+    File file;
+    QList<QPair<int, QUrl>> urls; // Priority, URL
+    bool inFile = false;
+    bool inPieces = false; // Piece hashes cover chunks, not the file
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (reader.isStartElement()) {
+            const QStringView name = reader.name();
+            if (name == u"file") {
+                file = File();
+                file.name = QFileInfo(reader.attributes().value("name").toString()).fileName(); // No directories
+                urls.clear();
+                inFile = true;
+            } else if (!inFile) {
+                continue;
+            } else if (name == u"pieces") {
+                inPieces = true;
+            } else if (name == u"size") {
+                file.size = reader.readElementText().trimmed().toLongLong();
+            } else if (name == u"hash" && !inPieces) {
+                const Checksum::Algorithm algorithm = Checksum::algorithmFromName(reader.attributes().value("type").toString());
+                const Checksum checksum(algorithm, QByteArray::fromHex(reader.readElementText().trimmed().toLatin1()));
+                if (checksum.isValid() && rank(algorithm) > rank(file.checksum.algorithm())) file.checksum = checksum;
+            } else if (name == u"url") {
+                const int priority = urlPriority(reader.attributes());
+                const QUrl url(reader.readElementText().trimmed());
+                if (url.scheme() == "http" || url.scheme() == "https") urls.append({priority, url});
+            }
+        } else if (reader.isEndElement()) {
+            if (reader.name() == u"pieces") {
+                inPieces = false;
+            } else if (reader.name() == u"file" && inFile) {
+                inFile = false;
+                std::stable_sort(urls.begin(), urls.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+                for (const auto &url : std::as_const(urls)) file.urls.append(url.second);
+                if (file.urls.isEmpty()) continue;
+                if (file.name.isEmpty()) file.name = QFileInfo(file.urls.first().path()).fileName();
+                m_files.append(file);
+            }
+        }
+    }
+
+    if (reader.hasError()) {
+        m_errorString = reader.errorString();
+        return false;
+    }
+    if (m_files.isEmpty()) {
+        m_errorString = QStringLiteral("No file with an HTTP(S) mirror");
+        return false;
+    }
+    return true;
+}
+
+bool Metalink::isMetalink(const QUrl &url)
+{
+    const QString suffix = QFileInfo(url.path()).suffix().toLower();
+    return suffix == "meta4" || suffix == "metalink";
+}
@@ -0,0 +1,36 @@
+#ifndef METALINK_H
+#define METALINK_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QUrl>
+#include "checksum.h"
+
+/**
+ * @brief A Metalink document: files with their size, checksum and the mirrors
+ * serving them. Reads Metalink 4 (.meta4, RFC 5854) and the older 3.0
+ * (.metalink) format.
+ */
+class Metalink
+{
+public:
+    struct File {
+        QString name;
+        qint64 size = -1;
+        Checksum checksum;  // Strongest hash listed
+        QList<QUrl> urls;   // Preferred mirror first
+    };
+
+    bool parse(const QByteArray &xml);
+    QList<File> files() const { return m_files; }
+    QString errorString() const { return m_errorString; }
+
+    static bool isMetalink(const QUrl &url); // By extension
+
+private:
+    QList<File> m_files;
+    QString m_errorString;
+};
+
+#endif // METALINK_H
@@ -0,0 +1,104 @@
+#include "mirrorset.h"
+#include "connectionpool.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+constexpr int kMaxConsecutiveFailures = 4;   // Then the mirror is dropped
+constexpr qint64 kBaseDemotionMs = 2000;     // Doubled with every further failure
+constexpr qint64 kMaxDemotionMs = 60000;
+constexpr double kUnmeasuredRate = 1e12;     // Untried mirrors go first, so all get measured
+constexpr double kSampleWeight = 0.3;
+}
+
+MirrorSet::MirrorSet()
+{
+    m_clock.start();
+}
+
+void MirrorSet::reset(const QList<QUrl> &urls)
+{
+    m_mirrors.clear();
+    for (const QUrl &url : urls) {
+        if (!url.isValid() || std::any_of(m_mirrors.cbegin(), m_mirrors.cend(), [&url](const Mirror &m) { return m.url == url; })) continue;
+        Mirror mirror;
+        mirror.url = url;
+        mirror.hostKey = ConnectionPool::hostKey(url);
+        mirror.host = url.host().toLower();
+        mirror.priority = m_mirrors.size();
+        m_mirrors.append(mirror);
+    }
+}
+
+bool MirrorSet::hasUsable() const
+{
+    return std::any_of(m_mirrors.cbegin(), m_mirrors.cend(), [](const Mirror &m) { return !m.dead; });
+}
+
+/**
+ * @brief Expected throughput of one more connection to the mirror: its measured
+ * per-connection rate, shared with the connections it already has and cut by
+ * its error rate.
+ */
+double MirrorSet::score(const Mirror &mirror, int load) const
+{
+    const double rate = mirror.throughput > 0 ? mirror.throughput : kUnmeasuredRate;
+    const double errorRate = mirror.requests > 0 ? double(mirror.errors) / mirror.requests : 0;
+    return rate / (1 + load) / (1 + 4 * errorRate);
+}
+
+QList<int> MirrorSet::ranked(const QList<int> &load) const
+{
+    const qint64 now = m_clock.elapsed();
+    QList<int> order;
+    for (int i = 0; i < m_mirrors.size(); ++i) {
+        if (!m_mirrors[i].dead) order.append(i);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        const Mirror &ma = m_mirrors[a];
+        const Mirror &mb = m_mirrors[b];
+        // Demoted mirrors only get work when nothing else takes it
+        const bool demotedA = ma.demotedUntil > now;
+        const bool demotedB = mb.demotedUntil > now;
+        if (demotedA != demotedB) return demotedB;
+        const double scoreA = score(ma, load.value(a));
+        const double scoreB = score(mb, load.value(b));
+        if (scoreA != scoreB) return scoreA > scoreB;
+        return ma.priority < mb.priority;
+    });
+    return order;
+}
+
+void MirrorSet::onRequest(int index)
+{
+    ++m_mirrors[index].requests;
+}
+
+void MirrorSet::onSample(int index, qint64 bytes, qint64 msecs)
+{
+    if (msecs <= 0) return;
+    Mirror &mirror = m_mirrors[index];
+    const double rate = bytes * 1000.0 / msecs;
+    mirror.throughput = mirror.throughput > 0 ? (1 - kSampleWeight) * mirror.throughput + kSampleWeight * rate : rate;
+}
+
+void MirrorSet::onSuccess(int index)
+{
+    m_mirrors[index].consecutiveFailures = 0;
+    m_mirrors[index].demotedUntil = 0;
+}
+
+void MirrorSet::onFailure(int index, bool permanent)
+{
+    Mirror &mirror = m_mirrors[index];
+    ++mirror.errors;
+    ++mirror.consecutiveFailures;
+    if (permanent || mirror.consecutiveFailures >= kMaxConsecutiveFailures) {
+        mirror.dead = true;
+        qWarning() << "MirrorSet: dropping" << mirror.url << "after" << mirror.consecutiveFailures << "failures";
+        return;
+    }
+    const qint64 demotion = qMin(kMaxDemotionMs, kBaseDemotionMs << (mirror.consecutiveFailures - 1));
+    mirror.demotedUntil = m_clock.elapsed() + demotion;
+    qDebug() << "MirrorSet: demoting" << mirror.url << "for" << demotion << "ms";
+}
@@ -0,0 +1,56 @@
+#ifndef MIRRORSET_H
+#define MIRRORSET_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+/**
+ * @brief The sources a segmented download can fetch its ranges from.
+ *
+ * Each mirror is scored by the throughput its connections reach and by how
+ * often its requests fail. New segments go to the best mirror that is not
+ * already crowded; a mirror that keeps failing is demoted for a growing while
+ * and finally dropped, so one bad server never fails the download.
+ */
+class MirrorSet
+{
+public:
+    struct Mirror {
+        QUrl url;
+        QString hostKey;
+        QString host; // Lower case; host speed limits are kept by it
+        int priority = 0;       // Lower is preferred when scores tie (Metalink order)
+        double throughput = 0;  // Smoothed bytes/s of one connection, 0 until measured
+        int requests = 0;
+        int errors = 0;
+        int consecutiveFailures = 0;
+        qint64 demotedUntil = 0; // On the set's clock
+        bool dead = false;
+    };
+
+    MirrorSet();
+
+    void reset(const QList<QUrl> &urls); // Index 0 is the primary URL
+    int size() const { return m_mirrors.size(); }
+    const Mirror &at(int index) const { return m_mirrors.at(index); }
+    bool hasUsable() const;
+
+    // Usable mirrors, best first; load holds the connections open per mirror
+    QList<int> ranked(const QList<int> &load) const;
+
+    void onRequest(int index);
+    void onSample(int index, qint64 bytes, qint64 msecs);
+    void onSuccess(int index);
+    // permanent: the mirror can never serve this file (404, no ranges, other size)
+    void onFailure(int index, bool permanent);
+
+private:
+    double score(const Mirror &mirror, int load) const;
+
+    QList<Mirror> m_mirrors;
+    QElapsedTimer m_clock;
+};
+
+#endif // MIRRORSET_H
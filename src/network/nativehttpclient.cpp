@@ -0,0 +1,93 @@
+#include "nativehttpclient.h"
+#include "nativehttpreply.h"
+#include <QTcpSocket>
+#include <QDebug>
+#ifndef QT_NO_SSL
+#include <QSslSocket>
+#endif
+
+NativeHttpClient::NativeHttpClient(QObject *parent)
+    : QObject(parent)
+{
+}
+
+NativeHttpClient::~NativeHttpClient()
+{
+    for (const QList<QTcpSocket*> &sockets : std::as_const(m_idleSockets)) {
+        for (QTcpSocket *socket : sockets) {
+            disconnect(socket, nullptr, this, nullptr);
+            socket->abort();
+        }
+    }
+}
+
+QNetworkReply *NativeHttpClient::get(const QNetworkRequest &request)
+{
+    auto *reply = new NativeHttpReply(this, QNetworkAccessManager::GetOperation, request, this);
+    reply->start();
+    return reply;
+}
+
+QNetworkReply *NativeHttpClient::head(const QNetworkRequest &request)
+{
+    auto *reply = new NativeHttpReply(this, QNetworkAccessManager::HeadOperation, request, this);
+    reply->start();
+    return reply;
+}
+
+QString NativeHttpClient::originKey(const QUrl &url)
+{
+    return QString("%1://%2:%3").arg(url.scheme(), url.host().toLower())
+        .arg(url.port(url.scheme() == "https" ? 443 : 80));
+}
+
+/**
+ * @brief Hands out a parked keep-alive socket for the origin, or a new,
+ * unconnected one. *reused tells the caller which it got.
+ */
+QTcpSocket *NativeHttpClient::takeSocket(const QUrl &url, bool forceNew, bool *reused)
+{
+    QList<QTcpSocket*> &idle = m_idleSockets[originKey(url)];
+    while (!forceNew && !idle.isEmpty()) {
+        QTcpSocket *socket = idle.takeLast();
+        disconnect(socket, nullptr, this, nullptr);
+        if (socket->state() == QAbstractSocket::ConnectedState && socket->bytesAvailable() == 0) {
+            *reused = true;
+            return socket;
+        }
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    *reused = false;
+    QTcpSocket *socket = nullptr;
+#ifndef QT_NO_SSL
+    if (url.scheme() == "https") socket = new QSslSocket(this);
+#endif
+    if (!socket) socket = new QTcpSocket(this);
+    socket->setProxy(m_proxy);
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    return socket;
+}
+
+/**
+ * @brief Parks a socket whose response was read completely, for the next request to the same origin.
+ */
+void NativeHttpClient::recycleSocket(const QUrl &url, QTcpSocket *socket)
+{
+    QList<QTcpSocket*> &idle = m_idleSockets[originKey(url)];
+    if (idle.size() >= m_maxIdlePerOrigin) {
+        socket->abort();
+        socket->deleteLater();
+        return;
+    }
+    socket->setReadBufferSize(0);
+    const QString key = originKey(url);
+    // The server may close an idle connection at any time
+    connect(socket, &QTcpSocket::disconnected, this, [this, key, socket]() {
+        m_idleSockets[key].removeOne(socket);
+        socket->deleteLater();
+    });
+    idle.append(socket);
+}
@@ -0,0 +1,47 @@
+#ifndef NATIVEHTTPCLIENT_H
+#define NATIVEHTTPCLIENT_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QNetworkProxy>
+#include <QNetworkRequest>
+
+class QNetworkReply;
+class QTcpSocket;
+
+/**
+ * @brief Minimal HTTP/1.1 client speaking directly over QTcpSocket/QSslSocket.
+ *
+ * Unlike QNetworkAccessManager it has no per-host connection limit: every
+ * request in flight gets its own socket, and finished keep-alive sockets are
+ * parked per origin and reused for the next range request. Lives on the
+ * thread that created it.
+ */
+class NativeHttpClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NativeHttpClient(QObject *parent = nullptr);
+    ~NativeHttpClient();
+
+    void setProxy(const QNetworkProxy &proxy) { m_proxy = proxy; }
+    QNetworkProxy proxy() const { return m_proxy; }
+    void setMaxIdlePerOrigin(int max) { m_maxIdlePerOrigin = qMax(0, max); }
+
+    QNetworkReply *get(const QNetworkRequest &request);
+    QNetworkReply *head(const QNetworkRequest &request);
+
+private:
+    friend class NativeHttpReply;
+
+    QTcpSocket *takeSocket(const QUrl &url, bool forceNew, bool *reused);
+    void recycleSocket(const QUrl &url, QTcpSocket *socket);
+    static QString originKey(const QUrl &url);
+
+    QNetworkProxy m_proxy;
+    QHash<QString, QList<QTcpSocket*>> m_idleSockets;
+    int m_maxIdlePerOrigin = 32;
+};
+
+#endif // NATIVEHTTPCLIENT_H
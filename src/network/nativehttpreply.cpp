@@ -0,0 +1,434 @@
+#include "nativehttpreply.h"
+#include "nativehttpclient.h"
+#include <QTcpSocket>
+#include <QDebug>
+#include <cstring>
+#ifndef QT_NO_SSL
+#include <QSslSocket>
+#endif
+
+namespace {
+constexpr int kMaxRedirects = 10;
+constexpr qint64 kMaxHeaderLine = 64 * 1024;
+
+QNetworkReply::NetworkError errorForStatus(int status)
+{
+    switch (status) {
+    case 401: return QNetworkReply::AuthenticationRequiredError;
+    case 403: return QNetworkReply::ContentAccessDenied;
+    case 404: return QNetworkReply::ContentNotFoundError;
+    case 405: return QNetworkReply::ContentOperationNotPermittedError;
+    case 407: return QNetworkReply::ProxyAuthenticationRequiredError;
+    case 409: return QNetworkReply::ContentConflictError;
+    case 410: return QNetworkReply::ContentGoneError;
+    case 500: return QNetworkReply::InternalServerError;
+    case 501: return QNetworkReply::OperationNotImplementedError;
+    case 503: return QNetworkReply::ServiceUnavailableError;
+    default: return status >= 500 ? QNetworkReply::UnknownServerError : QNetworkReply::UnknownContentError;
+    }
+}
+
+QNetworkReply::NetworkError errorForSocket(QAbstractSocket::SocketError error)
+{
+    switch (error) {
+    case QAbstractSocket::ConnectionRefusedError: return QNetworkReply::ConnectionRefusedError;
+    case QAbstractSocket::RemoteHostClosedError: return QNetworkReply::RemoteHostClosedError;
+    case QAbstractSocket::HostNotFoundError: return QNetworkReply::HostNotFoundError;
+    case QAbstractSocket::SocketTimeoutError: return QNetworkReply::TimeoutError;
+    case QAbstractSocket::SslHandshakeFailedError: return QNetworkReply::SslHandshakeFailedError;
+    case QAbstractSocket::ProxyConnectionRefusedError: return QNetworkReply::ProxyConnectionRefusedError;
+    case QAbstractSocket::ProxyConnectionClosedError: return QNetworkReply::ProxyConnectionClosedError;
+    case QAbstractSocket::ProxyNotFoundError: return QNetworkReply::ProxyNotFoundError;
+    case QAbstractSocket::ProxyConnectionTimeoutError: return QNetworkReply::ProxyTimeoutError;
+    case QAbstractSocket::ProxyAuthenticationRequiredError: return QNetworkReply::ProxyAuthenticationRequiredError;
+    default: return QNetworkReply::UnknownNetworkError;
+    }
+}
+}
+
+NativeHttpReply::NativeHttpReply(NativeHttpClient *client, QNetworkAccessManager::Operation operation,
+                                 const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply(parent), m_client(client)
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(operation);
+    QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+NativeHttpReply::~NativeHttpReply()
+{
+    detachSocket(false);
+}
+
+void NativeHttpReply::start()
+{
+    const QString scheme = url().scheme();
+    if (scheme != "http" && scheme != "https") {
+        // Report asynchronously, like QNetworkAccessManager, so callers can connect first
+        QMetaObject::invokeMethod(this, [this]() {
+            failWith(ProtocolUnknownError, "Protocol \"" + url().scheme() + "\" is unknown");
+        }, Qt::QueuedConnection);
+        return;
+    }
+    attachSocket(false);
+}
+
+void NativeHttpReply::attachSocket(bool forceNew)
+{
+    m_socket = m_client->takeSocket(url(), forceNew, &m_socketReused);
+    m_socket->setReadBufferSize(m_readBufferLimit);
+    connect(m_socket, &QTcpSocket::readyRead, this, [this]() { processSocketData(); });
+    connect(m_socket, &QTcpSocket::disconnected, this, &NativeHttpReply::onSocketDisconnected);
+    connect(m_socket, &QAbstractSocket::errorOccurred, this, &NativeHttpReply::onSocketError);
+
+    if (m_socketReused) {
+        QMetaObject::invokeMethod(this, &NativeHttpReply::sendRequest, Qt::QueuedConnection);
+        return;
+    }
+
+    const QUrl target = url();
+#ifndef QT_NO_SSL
+    if (auto *ssl = qobject_cast<QSslSocket*>(m_socket)) {
+        connect(ssl, &QSslSocket::encrypted, this, &NativeHttpReply::sendRequest);
+        ssl->connectToHostEncrypted(target.host(), target.port(443));
+        return;
+    }
+#endif
+    connect(m_socket, &QTcpSocket::connected, this, &NativeHttpReply::sendRequest);
+    m_socket->connectToHost(target.host(), target.port(80));
+}
+
+/**
+ * @brief Gives the socket back to the client if the exchange left it clean,
+ * otherwise closes it.
+ */
+void NativeHttpReply::detachSocket(bool reusable)
+{
+    if (!m_socket) return;
+    QTcpSocket *socket = m_socket;
+    m_socket = nullptr;
+    disconnect(socket, nullptr, this, nullptr);
+    if (reusable && socket->state() == QAbstractSocket::ConnectedState && socket->bytesAvailable() == 0) {
+        m_client->recycleSocket(url(), socket);
+    } else {
+        socket->abort();
+        socket->deleteLater();
+    }
+}
+
+void NativeHttpReply::sendRequest()
+{
+    if (!m_socket || isFinished()) return;
+
+    const QUrl target = url();
+    QByteArray path = target.path(QUrl::FullyEncoded).toLatin1();
+    if (path.isEmpty()) path = "/";
+    if (target.hasQuery()) path += '?' + target.query(QUrl::FullyEncoded).toLatin1();
+
+    QByteArray host = target.host(QUrl::FullyEncoded).toLatin1();
+    const int defaultPort = target.scheme() == "https" ? 443 : 80;
+    if (target.port(defaultPort) != defaultPort) host += ':' + QByteArray::number(target.port());
+
+    QByteArray head;
+    head += (operation() == QNetworkAccessManager::HeadOperation ? "HEAD " : "GET ") + path + " HTTP/1.1\r\n";
+    head += "Host: " + host + "\r\n";
+    const QString userAgent = request().header(QNetworkRequest::UserAgentHeader).toString();
+    if (!userAgent.isEmpty()) head += "User-Agent: " + userAgent.toLatin1() + "\r\n";
+    for (const QByteArray &name : request().rawHeaderList()) {
+        head += name + ": " + request().rawHeader(name) + "\r\n";
+    }
+    // Byte ranges only make sense on the identity encoding
+    head += "Accept-Encoding: identity\r\nConnection: keep-alive\r\n\r\n";
+
+    resetResponse();
+    m_socket->write(head);
+}
+
+void NativeHttpReply::resetResponse()
+{
+    m_parseState = StatusLine;
+    m_statusCode = 0;
+    m_keepAlive = true;
+    m_discardBody = false;
+    m_bodyRemaining = -1;
+    m_chunkRemaining = 0;
+    m_gotResponseBytes = false;
+    // Headers of a redirect response must not leak into the final one
+    for (const QByteArray &name : rawHeaderList()) setRawHeader(name, QByteArray());
+}
+
+void NativeHttpReply::processSocketData()
+{
+    while (m_socket && m_parseState != Done && !isFinished()) {
+        if (m_parseState == Body || m_parseState == ChunkData) {
+            const qint64 wanted = m_parseState == ChunkData ? m_chunkRemaining
+                                  : m_bodyRemaining >= 0 ? m_bodyRemaining : m_socket->bytesAvailable();
+            qint64 room = m_socket->bytesAvailable();
+            if (m_readBufferLimit > 0 && !m_discardBody) room = qMin(room, m_readBufferLimit - (m_buffer.size() - m_readPos));
+            const qint64 n = qMin(wanted, room);
+            if (n <= 0 && wanted > 0) return; // Wait for data, or for the reader to make room
+
+            QByteArray data = m_socket->read(n);
+            m_gotResponseBytes = true;
+            if (m_parseState == ChunkData) {
+                m_chunkRemaining -= data.size();
+                if (m_chunkRemaining == 0) m_parseState = ChunkDataEnd;
+            } else if (m_bodyRemaining >= 0) {
+                m_bodyRemaining -= data.size();
+            }
+            if (!data.isEmpty() && !m_discardBody) {
+                m_buffer.append(data);
+                emit readyRead();
+            }
+            if (m_parseState == Body && m_bodyRemaining == 0) finishResponse();
+            if (data.isEmpty()) return;
+            continue;
+        }
+
+        if (!m_socket->canReadLine()) {
+            if (m_socket->bytesAvailable() > kMaxHeaderLine) failWith(ProtocolFailure, "Response header line too long");
+            return;
+        }
+        m_gotResponseBytes = true;
+        if (!handleLine(m_socket->readLine())) return;
+    }
+}
+
+/**
+ * @brief Feeds one CRLF-terminated line of the status line, headers or chunk framing.
+ * @return false once the reply no longer owns the socket.
+ */
+bool NativeHttpReply::handleLine(const QByteArray &rawLine)
+{
+    const QByteArray line = rawLine.trimmed();
+    switch (m_parseState) {
+    case StatusLine: {
+        if (line.isEmpty()) return true;
+        const QList<QByteArray> parts = line.split(' ');
+        if (parts.size() < 2 || !parts[0].startsWith("HTTP/1.")) {
+            failWith(ProtocolFailure, "Invalid HTTP status line");
+            return false;
+        }
+        m_keepAlive = parts[0] == "HTTP/1.1";
+        m_statusCode = parts[1].toInt();
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, m_statusCode);
+        setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, QString::fromLatin1(line.mid(parts[0].size() + parts[1].size() + 2)));
+        m_parseState = Headers;
+        return true;
+    }
+    case Headers: {
+        if (line.isEmpty()) return headersComplete();
+        const int colon = line.indexOf(':');
+        if (colon > 0) setRawHeader(line.left(colon).trimmed(), line.mid(colon + 1).trimmed());
+        return true;
+    }
+    case ChunkSize: {
+        bool ok = false;
+        const int semicolon = line.indexOf(';');
+        m_chunkRemaining = (semicolon >= 0 ? line.left(semicolon) : line).trimmed().toLongLong(&ok, 16);
+        if (!ok || m_chunkRemaining < 0) {
+            failWith(ProtocolFailure, "Invalid chunk size");
+            return false;
+        }
+        m_parseState = m_chunkRemaining == 0 ? ChunkTrailer : ChunkData;
+        return true;
+    }
+    case ChunkDataEnd:
+        m_parseState = ChunkSize;
+        return true;
+    case ChunkTrailer:
+        if (line.isEmpty()) {
+            finishResponse();
+            return false;
+        }
+        return true;
+    default:
+        return true;
+    }
+}
+
+bool NativeHttpReply::headersComplete()
+{
+    if (m_statusCode >= 100 && m_statusCode < 200) {
+        m_parseState = StatusLine; // Interim response, the real one follows
+        return true;
+    }
+
+    const QByteArray connection = rawHeader("Connection").toLower();
+    if (connection.contains("close")) m_keepAlive = false;
+    else if (connection.contains("keep-alive")) m_keepAlive = true;
+
+    const bool noBody = operation() == QNetworkAccessManager::HeadOperation
+                        || m_statusCode == 204 || m_statusCode == 304;
+    const bool chunked = rawHeader("Transfer-Encoding").toLower().contains("chunked");
+    if (noBody) {
+        m_bodyRemaining = 0;
+    } else if (!chunked) {
+        bool ok = false;
+        const qint64 length = rawHeader("Content-Length").toLongLong(&ok);
+        m_bodyRemaining = ok ? length : -1;
+        if (!ok) m_keepAlive = false; // Body ends when the server closes
+    }
+
+    if (m_statusCode >= 300 && m_statusCode < 400 && m_statusCode != 304 && hasRawHeader("Location")) {
+        return !followRedirect();
+    }
+
+    if (m_statusCode >= 400) {
+        m_discardBody = true;
+        const QString reason = attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString();
+        setError(errorForStatus(m_statusCode), QString("Server replied: %1 %2").arg(m_statusCode).arg(reason));
+        emit errorOccurred(error());
+    }
+    emit metaDataChanged();
+    if (isFinished() || !m_socket) return false; // Aborted by a slot
+
+    if (chunked && !noBody) {
+        m_parseState = ChunkSize;
+    } else {
+        m_parseState = Body;
+        if (m_bodyRemaining == 0) {
+            finishResponse();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Re-issues the request at the Location target. The old connection is
+ * dropped rather than draining a redirect body we do not need.
+ */
+bool NativeHttpReply::followRedirect()
+{
+    if (++m_redirects > kMaxRedirects) {
+        failWith(TooManyRedirectsError, "Too many redirects");
+        return true;
+    }
+    const QUrl target = url().resolved(QUrl::fromEncoded(rawHeader("Location")));
+    if (target.scheme() != "http" && target.scheme() != "https") {
+        failWith(InsecureRedirectError, "Redirect to an unsupported scheme");
+        return true;
+    }
+    if (url().scheme() == "https" && target.scheme() == "http") {
+        failWith(InsecureRedirectError, "Refusing to redirect from HTTPS to HTTP");
+        return true;
+    }
+
+    detachSocket(false);
+    setUrl(target);
+    emit redirected(target);
+    if (isFinished()) return true;
+    m_retriedStale = false;
+    attachSocket(false);
+    return true;
+}
+
+void NativeHttpReply::finishResponse()
+{
+    if (isFinished()) return;
+    m_parseState = Done;
+    detachSocket(m_keepAlive);
+    setFinished(true);
+    emit readChannelFinished();
+    emit finished();
+}
+
+void NativeHttpReply::failWith(NetworkError code, const QString &message)
+{
+    if (isFinished()) return;
+    detachSocket(false);
+    setError(code, message);
+    emit errorOccurred(code);
+    setFinished(true);
+    emit finished();
+}
+
+void NativeHttpReply::onSocketDisconnected()
+{
+    if (!m_socket || isFinished()) return;
+    processSocketData(); // Whatever arrived before the close
+    if (!m_socket || isFinished()) return;
+
+    if (m_parseState == Body && m_bodyRemaining < 0) {
+        // Close-delimited body: the connection is gone, so nothing is left to throttle
+        QByteArray rest = m_socket->readAll();
+        if (!rest.isEmpty() && !m_discardBody) {
+            m_buffer.append(rest);
+            emit readyRead();
+        }
+        if (!m_socket || isFinished()) return;
+        m_keepAlive = false;
+        finishResponse();
+        return;
+    }
+    onSocketError(QAbstractSocket::RemoteHostClosedError);
+}
+
+void NativeHttpReply::onSocketError(QAbstractSocket::SocketError socketError)
+{
+    if (!m_socket || isFinished()) return;
+
+    // A parked keep-alive socket the server already gave up on: try once more on a fresh one
+    if (m_socketReused && !m_gotResponseBytes && !m_retriedStale) {
+        m_retriedStale = true;
+        detachSocket(false);
+        attachSocket(true);
+        return;
+    }
+    if (socketError == QAbstractSocket::RemoteHostClosedError && m_parseState == Body && m_bodyRemaining < 0) {
+        onSocketDisconnected();
+        return;
+    }
+    failWith(errorForSocket(socketError), m_socket->errorString());
+}
+
+void NativeHttpReply::abort()
+{
+    if (isFinished()) return;
+    detachSocket(false);
+    setError(OperationCanceledError, "Operation canceled");
+    emit errorOccurred(OperationCanceledError);
+    setFinished(true);
+    emit finished();
+}
+
+qint64 NativeHttpReply::bytesAvailable() const
+{
+    return m_buffer.size() - m_readPos + QNetworkReply::bytesAvailable();
+}
+
+void NativeHttpReply::setReadBufferSize(qint64 size)
+{
+    QNetworkReply::setReadBufferSize(size);
+    m_readBufferLimit = size;
+    if (m_socket) m_socket->setReadBufferSize(size);
+    // A larger buffer may let more of what the socket holds through
+    if (m_socket && m_socket->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, [this]() { processSocketData(); }, Qt::QueuedConnection);
+    }
+}
+
+qint64 NativeHttpReply::readData(char *data, qint64 maxlen)
+{
+    const qint64 available = m_buffer.size() - m_readPos;
+    if (available <= 0) return isFinished() ? -1 : 0;
+
+    const qint64 n = qMin(maxlen, available);
+    std::memcpy(data, m_buffer.constData() + m_readPos, static_cast<size_t>(n));
+    m_readPos += n;
+    if (m_readPos == m_buffer.size()) {
+        m_buffer.clear();
+        m_readPos = 0;
+    } else if (m_readPos > 1024 * 1024) {
+        m_buffer.remove(0, m_readPos);
+        m_readPos = 0;
+    }
+
+    // Reading made room: pull in what the bounded buffer left on the socket
+    if (m_readBufferLimit > 0 && m_socket && m_socket->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, [this]() { processSocketData(); }, Qt::QueuedConnection);
+    }
+    return n;
+}
@@ -0,0 +1,75 @@
+#ifndef NATIVEHTTPREPLY_H
+#define NATIVEHTTPREPLY_H
+
+#include <QNetworkReply>
+#include <QNetworkAccessManager>
+#include <QAbstractSocket>
+
+class NativeHttpClient;
+class QTcpSocket;
+
+/**
+ * @brief One HTTP/1.1 request/response exchanged directly over a socket
+ * borrowed from a NativeHttpClient.
+ *
+ * Behaves like the replies QNetworkAccessManager hands out (status attribute,
+ * raw headers, readyRead/finished, errors for 4xx/5xx, redirects followed), so
+ * DownloadItem can use either transport through the same code. Honours
+ * setReadBufferSize() by leaving data in the kernel once the buffer is full.
+ */
+class NativeHttpReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    NativeHttpReply(NativeHttpClient *client, QNetworkAccessManager::Operation operation,
+                    const QNetworkRequest &request, QObject *parent = nullptr);
+    ~NativeHttpReply();
+
+    void abort() override;
+    qint64 bytesAvailable() const override;
+    bool isSequential() const override { return true; }
+    void setReadBufferSize(qint64 size) override;
+
+    void start();
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+
+private slots:
+    void sendRequest();
+    void onSocketDisconnected();
+    void onSocketError(QAbstractSocket::SocketError socketError);
+
+private:
+    enum ParseState { StatusLine, Headers, Body, ChunkSize, ChunkData, ChunkDataEnd, ChunkTrailer, Done };
+
+    void attachSocket(bool forceNew);
+    void detachSocket(bool reusable);
+    void processSocketData();
+    bool handleLine(const QByteArray &line);
+    bool headersComplete();
+    void finishResponse();
+    void failWith(NetworkError code, const QString &message);
+    bool followRedirect();
+    void resetResponse();
+
+    NativeHttpClient *m_client;
+    QTcpSocket *m_socket = nullptr;
+    bool m_socketReused = false;
+    bool m_retriedStale = false;
+    bool m_gotResponseBytes = false;
+
+    ParseState m_parseState = StatusLine;
+    int m_statusCode = 0;
+    bool m_keepAlive = true;
+    bool m_discardBody = false;     // Error and redirect bodies are not handed to the reader
+    qint64 m_bodyRemaining = -1;    // -1: body runs until the server closes
+    qint64 m_chunkRemaining = 0;
+    int m_redirects = 0;
+
+    QByteArray m_buffer;
+    qint64 m_readPos = 0;
+    qint64 m_readBufferLimit = 0;
+};
+
+#endif // NATIVEHTTPREPLY_H
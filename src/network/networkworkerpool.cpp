@@ -0,0 +1,65 @@
+#include "networkworkerpool.h"
+#include <QDebug>
+#include <QHash>
+
+NetworkWorkerPool::NetworkWorkerPool(int threadCount)
+    : m_threadCount(threadCount > 0 ? threadCount : qBound(2, QThread::idealThreadCount() / 2, 4))
+{
+}
+
+NetworkWorkerPool::~NetworkWorkerPool()
+{
+    shutdown();
+}
+
+/**
+ * @brief Stops the worker threads. Objects still living on them that were
+ * deleteLater()'d are destroyed as each thread finishes.
+ */
+void NetworkWorkerPool::shutdown()
+{
+    for (QThread *thread : m_threads) {
+        thread->quit();
+        if (!thread->wait(5000)) {
+            qWarning() << "Network worker" << thread->objectName() << "did not stop, forcing termination";
+            thread->terminate();
+            thread->wait();
+        }
+        delete thread;
+    }
+    m_threads.clear();
+    m_next = 0;
+}
+
+/**
+ * @brief Moves object (which must have no parent and live on the calling
+ * thread) to one of the workers.
+ */
+bool NetworkWorkerPool::adopt(QObject *object, const QString &affinityKey)
+{
+    if (!object || object->parent() || object->thread() != QThread::currentThread()) {
+        qWarning() << "NetworkWorkerPool: cannot move" << object << "to a worker thread";
+        return false;
+    }
+    object->moveToThread(affinityKey.isEmpty() ? nextThread() : threadAt(qHash(affinityKey) % m_threadCount));
+    return true;
+}
+
+QThread *NetworkWorkerPool::nextThread()
+{
+    if (m_threads.size() < m_threadCount) return threadAt(m_threads.size());
+    QThread *thread = m_threads[m_next];
+    m_next = (m_next + 1) % m_threads.size();
+    return thread;
+}
+
+QThread *NetworkWorkerPool::threadAt(int index)
+{
+    while (m_threads.size() <= index) {
+        QThread *thread = new QThread;
+        thread->setObjectName(QString("NetworkWorker-%1").arg(m_threads.size()));
+        thread->start();
+        m_threads.append(thread);
+    }
+    return m_threads[index];
+}
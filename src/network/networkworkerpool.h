@@ -0,0 +1,35 @@
+#ifndef NETWORKWORKERPOOL_H
+#define NETWORKWORKERPOOL_H
+
+#include <QList>
+#include <QObject>
+#include <QThread>
+
+/**
+ * @brief A few threads, each running its own event loop, that downloads are
+ * moved onto so that socket reads and file writes stay off the GUI thread.
+ *
+ * Threads are started on first use and handed out round-robin, unless the
+ * caller passes an affinity key: objects with the same key always land on the
+ * same thread (used to put HTTP/2 downloads of one origin on one connection).
+ */
+class NetworkWorkerPool
+{
+public:
+    explicit NetworkWorkerPool(int threadCount = 0);
+    ~NetworkWorkerPool();
+
+    bool adopt(QObject *object, const QString &affinityKey = QString());
+    void shutdown();
+    int threadCount() const { return m_threadCount; }
+
+private:
+    QThread *nextThread();
+    QThread *threadAt(int index);
+
+    int m_threadCount;
+    int m_next = 0;
+    QList<QThread*> m_threads;
+};
+
+#endif // NETWORKWORKERPOOL_H
@@ -0,0 +1,135 @@
+#include "ratelimiter.h"
+#include <QDebug>
+
+namespace {
+constexpr int kRefillIntervalMs = 50;
+// Buckets hold at most this much time worth of tokens, which bounds bursts
+constexpr double kBurstSeconds = 0.25;
+constexpr qint64 kMinReadBuffer = 16 * 1024;
+constexpr qint64 kMaxReadBuffer = 1024 * 1024;
+}
+
+RateLimiter::RateLimiter(QObject *parent)
+    : QObject(parent)
+{
+    m_refillTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_refillTimer, &QTimer::timeout, this, &RateLimiter::refill);
+}
+
+void RateLimiter::setGlobalRate(qint64 bytesPerSec)
+{
+    QMutexLocker locker(&m_mutex);
+    setRate(m_global, bytesPerSec);
+    updateTimer();
+}
+
+void RateLimiter::setHostRate(const QString &host, qint64 bytesPerSec)
+{
+    QMutexLocker locker(&m_mutex);
+    if (bytesPerSec > 0) setRate(m_hosts[host], bytesPerSec);
+    else m_hosts.remove(host);
+    updateTimer();
+}
+
+void RateLimiter::setItemRate(QObject *item, qint64 bytesPerSec)
+{
+    QMutexLocker locker(&m_mutex);
+    if (bytesPerSec > 0) setRate(m_items[item], bytesPerSec);
+    else m_items.remove(item);
+    updateTimer();
+}
+
+void RateLimiter::removeItem(QObject *item)
+{
+    QMutexLocker locker(&m_mutex);
+    m_items.remove(item);
+    m_waiting.remove(item);
+    updateTimer();
+}
+
+void RateLimiter::setRate(Bucket &bucket, qint64 bytesPerSec)
+{
+    bucket.rate = qMax<qint64>(0, bytesPerSec);
+    bucket.tokens = qMin(bucket.tokens, bucket.rate * kBurstSeconds);
+}
+
+/**
+ * @brief Runs the refill timer only while some bucket has a limit. The timer
+ * lives on this object's thread, so it is poked through the event loop.
+ */
+void RateLimiter::updateTimer()
+{
+    bool limited = m_global.rate > 0 || !m_hosts.isEmpty() || !m_items.isEmpty();
+    QMetaObject::invokeMethod(this, [this, limited]() {
+        if (limited && !m_refillTimer.isActive()) {
+            m_sinceRefill.start();
+            m_refillTimer.start(kRefillIntervalMs);
+        } else if (!limited) {
+            m_refillTimer.stop();
+            refill(); // Wake anyone still waiting
+        }
+    }, Qt::QueuedConnection);
+}
+
+void RateLimiter::refillBucket(Bucket &bucket, double seconds)
+{
+    if (bucket.rate <= 0) return;
+    bucket.tokens = qMin(bucket.tokens + bucket.rate * seconds, bucket.rate * kBurstSeconds);
+}
+
+qint64 RateLimiter::acquire(QObject *item, const QString &host, qint64 wanted)
+{
+    if (wanted <= 0) return 0;
+    QMutexLocker locker(&m_mutex);
+
+    Bucket *buckets[3] = {&m_global, nullptr, nullptr};
+    auto hostBucket = m_hosts.find(host);
+    if (hostBucket != m_hosts.end()) buckets[1] = &hostBucket.value();
+    auto own = m_items.find(item);
+    if (own != m_items.end()) buckets[2] = &own.value();
+
+    qint64 granted = wanted;
+    for (Bucket *bucket : buckets) {
+        if (bucket && bucket->rate > 0) granted = qMin(granted, static_cast<qint64>(bucket->tokens));
+    }
+    if (granted <= 0) {
+        m_waiting.insert(item);
+        return 0;
+    }
+    for (Bucket *bucket : buckets) {
+        if (bucket && bucket->rate > 0) bucket->tokens -= granted;
+    }
+    return granted;
+}
+
+/**
+ * @brief About 100 ms worth of the tightest applicable rate: small enough that
+ * a stalled reader quickly closes the TCP window, large enough to keep it busy.
+ */
+qint64 RateLimiter::readBufferSizeFor(QObject *item, const QString &host)
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 rate = m_global.rate;
+    auto pick = [&rate](qint64 other) { if (other > 0 && (rate <= 0 || other < rate)) rate = other; };
+    pick(m_hosts.value(host).rate);
+    pick(m_items.value(item).rate);
+    if (rate <= 0) return 0;
+    return qBound(kMinReadBuffer, rate / 10, kMaxReadBuffer);
+}
+
+void RateLimiter::refill()
+{
+    QMutexLocker locker(&m_mutex);
+    double seconds = m_sinceRefill.isValid() ? m_sinceRefill.restart() / 1000.0 : 0;
+    refillBucket(m_global, seconds);
+    for (Bucket &bucket : m_hosts) refillBucket(bucket, seconds);
+    for (Bucket &bucket : m_items) refillBucket(bucket, seconds);
+
+    // Posted under the lock: an item being destroyed blocks in removeItem()
+    // until we are done, and its destructor then discards the pending call.
+    // Waiters that still find a bucket empty simply queue up again.
+    for (QObject *item : std::as_const(m_waiting)) {
+        QMetaObject::invokeMethod(item, "resumeReading", Qt::QueuedConnection);
+    }
+    m_waiting.clear();
+}
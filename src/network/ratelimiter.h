@@ -0,0 +1,60 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+/**
+ * @brief Hierarchical token-bucket bandwidth limiter shared by all downloads.
+ *
+ * Every read must fit in the global bucket, the bucket of its host and the
+ * bucket of its item. A single timer refills all buckets. A reader that finds
+ * a bucket empty is told to stop reading (it keeps a small read buffer so TCP
+ * flow control slows the sender) and is woken through its resumeReading()
+ * slot once tokens are back. A rate of 0 means unlimited.
+ */
+class RateLimiter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RateLimiter(QObject *parent = nullptr);
+
+    void setGlobalRate(qint64 bytesPerSec);
+    // host: a lower-case host name; all schemes and ports of it share the bucket
+    void setHostRate(const QString &host, qint64 bytesPerSec);
+    void setItemRate(QObject *item, qint64 bytesPerSec);
+    void removeItem(QObject *item);
+
+    // Thread-safe. Returns how many of wanted bytes may be read now (possibly
+    // 0, in which case item is woken later) and takes them from the buckets.
+    qint64 acquire(QObject *item, const QString &host, qint64 wanted);
+    // Read buffer a throttled reply should use; 0 when nothing limits it
+    qint64 readBufferSizeFor(QObject *item, const QString &host);
+
+private slots:
+    void refill();
+
+private:
+    struct Bucket {
+        qint64 rate = 0;
+        double tokens = 0;
+    };
+
+    void setRate(Bucket &bucket, qint64 bytesPerSec);
+    void updateTimer();
+    static void refillBucket(Bucket &bucket, double seconds);
+
+    QMutex m_mutex;
+    Bucket m_global;
+    QHash<QString, Bucket> m_hosts; // By host name
+    QHash<QObject*, Bucket> m_items;
+    QSet<QObject*> m_waiting;
+    QTimer m_refillTimer;
+    QElapsedTimer m_sinceRefill;
+};
+
+#endif // RATELIMITER_H
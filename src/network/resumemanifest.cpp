@@ -0,0 +1,86 @@
+#include "resumemanifest.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+namespace {
+constexpr int kManifestVersion = 1;
+}
+
+/**
+ * @brief Writes the manifest atomically, so a crash never leaves a torn file behind.
+ */
+bool ResumeManifest::save(const QString &path) const
+{
+    QJsonArray segments;
+    for (const Range &range : ranges) {
+        segments.append(QJsonArray{range.start, range.end, range.downloaded});
+    }
+
+    QJsonObject obj;
+    obj["version"] = kManifestVersion;
+    obj["url"] = url.toString();
+    obj["totalSize"] = QString::number(totalSize);
+    obj["etag"] = QString::fromLatin1(etag);
+    obj["lastModified"] = QString::fromLatin1(lastModified);
+    obj["mode"] = chunkFiles ? "chunks" : "direct";
+    obj["segments"] = segments;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "ResumeManifest: cannot write" << path << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+bool ResumeManifest::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    if (!doc.isObject()) {
+        qWarning() << "ResumeManifest: invalid manifest" << path;
+        return false;
+    }
+    QJsonObject obj = doc.object();
+    if (obj["version"].toInt() != kManifestVersion) return false;
+
+    url = QUrl(obj["url"].toString());
+    totalSize = obj["totalSize"].toString().toLongLong();
+    etag = obj["etag"].toString().toLatin1();
+    lastModified = obj["lastModified"].toString().toLatin1();
+    chunkFiles = obj["mode"].toString() == "chunks";
+    ranges.clear();
+
+    qint64 covered = 0;
+    for (const QJsonValue &val : obj["segments"].toArray()) {
+        QJsonArray triple = val.toArray();
+        if (triple.size() != 3) return false;
+        Range range{triple[0].toVariant().toLongLong(), triple[1].toVariant().toLongLong(),
+                    triple[2].toVariant().toLongLong()};
+        if (range.start < 0 || range.end <= range.start || range.end > totalSize) return false;
+        range.downloaded = qBound<qint64>(0, range.downloaded, range.end - range.start);
+        covered += range.end - range.start;
+        ranges.append(range);
+    }
+    // The ranges must tile the whole file, otherwise the manifest is useless
+    return totalSize > 0 && covered == totalSize;
+}
+
+/**
+ * @brief True if the remote file still looks like the one this manifest was written for.
+ */
+bool ResumeManifest::matches(qint64 size, const QByteArray &currentEtag, const QByteArray &currentLastModified) const
+{
+    if (size != totalSize) return false;
+    if (!etag.isEmpty() && !currentEtag.isEmpty()) return etag == currentEtag;
+    if (!lastModified.isEmpty() && !currentLastModified.isEmpty()) return lastModified == currentLastModified;
+    // Nothing to compare: only trust the size if no validator was recorded either
+    return etag.isEmpty() && lastModified.isEmpty();
+}
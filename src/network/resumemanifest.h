@@ -0,0 +1,39 @@
+#ifndef RESUMEMANIFEST_H
+#define RESUMEMANIFEST_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+/**
+ * @brief Sidecar file (<target>.idm) describing a partially downloaded file.
+ *
+ * Holds the segment table with the bytes done per segment, plus the validators
+ * the server sent, so a later session can tell whether it is still safe to
+ * continue and can send If-Range with its requests.
+ */
+class ResumeManifest
+{
+public:
+    struct Range {
+        qint64 start;
+        qint64 end;        // Exclusive
+        qint64 downloaded;
+    };
+
+    QUrl url;
+    qint64 totalSize = -1;
+    QByteArray etag;
+    QByteArray lastModified;
+    bool chunkFiles = false;
+    QList<Range> ranges;
+
+    static QString pathFor(const QString &filePath) { return filePath + ".idm"; }
+
+    bool save(const QString &path) const;
+    bool load(const QString &path);
+    bool matches(qint64 size, const QByteArray &currentEtag, const QByteArray &currentLastModified) const;
+};
+
+#endif // RESUMEMANIFEST_H
@@ -0,0 +1,316 @@
+#include "segmentfile.h"
+#include <QDebug>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#endif
+
+SegmentFile::SegmentFile(const QString &path)
+    : m_file(path)
+{
+}
+
+SegmentFile::~SegmentFile()
+{
+    close();
+}
+
+/**
+ * @brief Opens the file without truncating it, sizes it to totalSize and
+ * allocates its blocks. Existing content is kept so an interrupted download
+ * can continue in place.
+ */
+bool SegmentFile::open(qint64 totalSize)
+{
+    if (m_file.isOpen()) return true;
+
+    // Unbuffered: positional writes bypass QFile's buffer, so it must stay empty
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        m_errorString = m_file.errorString();
+        qCritical() << "SegmentFile: cannot open" << m_file.fileName() << m_errorString;
+        return false;
+    }
+
+    if (totalSize > 0 && m_file.size() > totalSize && !m_file.resize(totalSize)) {
+        m_errorString = m_file.errorString();
+        qCritical() << "SegmentFile: cannot resize" << m_file.fileName() << "to" << totalSize << m_errorString;
+        m_file.close();
+        return false;
+    }
+    if (totalSize > 0 && !reserve(0, totalSize)) {
+        qCritical() << "SegmentFile: cannot allocate" << totalSize << "bytes for" << m_file.fileName() << m_errorString;
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool SegmentFile::reserve(qint64 offset, qint64 length, bool keepSize)
+{
+    if (!m_file.isOpen() || length <= 0) return true;
+
+#if defined(Q_OS_LINUX)
+    int result;
+    do {
+        result = ::fallocate(m_file.handle(), keepSize ? FALLOC_FL_KEEP_SIZE : 0, static_cast<off_t>(offset), static_cast<off_t>(length));
+    } while (result < 0 && errno == EINTR);
+    if (result == 0) return true;
+    if (errno == ENOSPC || errno == EFBIG) {
+        m_errorString = QString::fromLocal8Bit(std::strerror(errno));
+        return false;
+    }
+    // EOPNOTSUPP and the like: this file system cannot preallocate
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+    if (!keepSize) {
+        const int result = ::posix_fallocate(m_file.handle(), static_cast<off_t>(offset), static_cast<off_t>(length));
+        if (result == 0) return true;
+        if (result == ENOSPC || result == EFBIG) {
+            m_errorString = QString::fromLocal8Bit(std::strerror(result));
+            return false;
+        }
+    }
+#endif
+    // Sparse fallback
+    if (keepSize || m_file.size() >= offset + length || m_file.resize(offset + length)) return true;
+    m_errorString = m_file.errorString();
+    return false;
+}
+
+void SegmentFile::close()
+{
+    if (m_file.isOpen()) {
+        m_file.flush();
+        m_file.close();
+    }
+}
+
+bool SegmentFile::remove()
+{
+    close();
+    return m_file.remove();
+}
+
+/**
+ * @brief Writes len bytes at offset without touching the shared file position.
+ * @return Number of bytes written, or -1 on error.
+ */
+qint64 SegmentFile::writeAt(qint64 offset, const char *data, qint64 len)
+{
+    if (!m_file.isOpen()) {
+        m_errorString = QStringLiteral("File is not open");
+        return -1;
+    }
+
+#ifdef Q_OS_UNIX
+    const int fd = m_file.handle();
+    qint64 written = 0;
+    while (written < len) {
+        ssize_t n = ::pwrite(fd, data + written, static_cast<size_t>(len - written), static_cast<off_t>(offset + written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            m_errorString = QString::fromLocal8Bit(std::strerror(errno));
+            return -1;
+        }
+        written += n;
+    }
+    return written;
+#else
+    QMutexLocker locker(&m_seekMutex);
+    if (!m_file.seek(offset)) {
+        m_errorString = m_file.errorString();
+        return -1;
+    }
+    qint64 written = m_file.write(data, len);
+    if (written < 0) m_errorString = m_file.errorString();
+    return written;
+#endif
+}
+
+qint64 SegmentFile::writeAt(qint64 offset, const QList<QByteArrayView> &parts)
+{
+#ifdef Q_OS_UNIX
+    if (parts.size() > 1 && parts.size() <= IOV_MAX && m_file.isOpen()) {
+        QList<iovec> iov(parts.size());
+        qint64 total = 0;
+        for (int i = 0; i < parts.size(); ++i) {
+            iov[i].iov_base = const_cast<char *>(parts[i].constData());
+            iov[i].iov_len = static_cast<size_t>(parts[i].size());
+            total += parts[i].size();
+        }
+        ssize_t n;
+        do {
+            n = ::pwritev(m_file.handle(), iov.constData(), iov.size(), static_cast<off_t>(offset));
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            m_errorString = QString::fromLocal8Bit(std::strerror(errno));
+            return -1;
+        }
+        if (n == total) return total;
+        // Short write: finish the rest part by part
+        qint64 done = n;
+        for (const QByteArrayView &part : parts) {
+            if (done >= part.size()) {
+                done -= part.size();
+                continue;
+            }
+            if (writeAt(offset + n, part.constData() + done, part.size() - done) < 0) return -1;
+            n += part.size() - done;
+            done = 0;
+        }
+        return total;
+    }
+#endif
+    qint64 written = 0;
+    for (const QByteArrayView &part : parts) {
+        if (writeAt(offset + written, part.data(), part.size()) < 0) return -1;
+        written += part.size();
+    }
+    return written;
+}
+
+/**
+ * @brief Reads up to len bytes at offset, like writeAt() without moving the
+ * file position. Stops early at the end of the file.
+ * @return Number of bytes read, or -1 on error.
+ */
+qint64 SegmentFile::readAt(qint64 offset, char *data, qint64 len)
+{
+    if (!m_file.isOpen()) {
+        m_errorString = QStringLiteral("File is not open");
+        return -1;
+    }
+
+#ifdef Q_OS_UNIX
+    const int fd = m_file.handle();
+    qint64 done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, data + done, static_cast<size_t>(len - done), static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            m_errorString = QString::fromLocal8Bit(std::strerror(errno));
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+#else
+    QMutexLocker locker(&m_seekMutex);
+    if (!m_file.seek(offset)) {
+        m_errorString = m_file.errorString();
+        return -1;
+    }
+    qint64 done = m_file.read(data, len);
+    if (done < 0) m_errorString = m_file.errorString();
+    return done;
+#endif
+}
+
+/**
+ * @brief Adds a write to the ranges of this round, joined with those it
+ * touches, so the list stays as short as the number of places being written.
+ */
+void SegmentFile::Writeback::note(qint64 offset, qint64 length)
+{
+    if (length <= 0) return;
+    pending += length;
+    Range added{offset, offset + length};
+    for (int i = written.size() - 1; i >= 0; --i) {
+        const Range &range = written.at(i);
+        if (range.start > added.end || range.end < added.start) continue;
+        added.start = qMin(added.start, range.start);
+        added.end = qMax(added.end, range.end);
+        written.removeAt(i);
+    }
+    written.append(added);
+}
+
+/**
+ * @brief Records a write in drop-behind mode; every kWritebackInterval bytes
+ * the ranges written get a writeBack().
+ */
+void SegmentFile::noteWritten(qint64 offset, qint64 bytes)
+{
+    if (!m_dropBehind || !m_file.isOpen()) return;
+    m_writeback.note(offset, bytes);
+    if (m_writeback.isDue()) writeBack(m_file.handle(), &m_writeback);
+}
+
+/**
+ * @brief Starts writeback of the ranges written since the last round without
+ * waiting for it, then waits for the previous round's ranges to reach the
+ * disk and drops them from the page cache. Called at regular intervals this
+ * keeps dirty and cached data bounded and the disk busy at a steady rate,
+ * rather than flushing everything at close. Pages outside those ranges, such
+ * as those a player is reading, are left alone.
+ */
+void SegmentFile::writeBack(int handle, Writeback *ranges)
+{
+#if defined(Q_OS_LINUX)
+    for (const Writeback::Range &range : std::as_const(ranges->written)) {
+        ::sync_file_range(handle, range.start, range.end - range.start, SYNC_FILE_RANGE_WRITE);
+    }
+    for (const Writeback::Range &range : std::as_const(ranges->syncing)) {
+        ::sync_file_range(handle, range.start, range.end - range.start,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(handle, range.start, range.end - range.start, POSIX_FADV_DONTNEED);
+    }
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+    // No asynchronous writeback here: the pages that were dirty one round ago
+    // have mostly been written by now, and only clean ones are dropped
+    for (const Writeback::Range &range : std::as_const(ranges->syncing)) {
+        ::posix_fadvise(handle, range.start, range.end - range.start, POSIX_FADV_DONTNEED);
+    }
+#else
+    Q_UNUSED(handle);
+#endif
+    ranges->syncing = std::move(ranges->written);
+    ranges->written.clear();
+    ranges->pending = 0;
+}
+
+qint64 SegmentFile::allocatedSize(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    struct stat info;
+    if (::stat(QFile::encodeName(path).constData(), &info) != 0) return 0;
+    return qMin<qint64>(static_cast<qint64>(info.st_blocks) * 512, info.st_size);
+#else
+    return QFileInfo(path).size();
+#endif
+}
+
+QStorageInfo SegmentFile::volumeOf(const QString &path)
+{
+    QFileInfo dir(QFileInfo(path).absolutePath());
+    while (!dir.exists() && !dir.isRoot()) dir = QFileInfo(dir.absolutePath());
+    return QStorageInfo(dir.absoluteFilePath());
+}
+
+bool SegmentFile::flush()
+{
+    return m_file.isOpen() && m_file.flush();
+}
+
+bool SegmentFile::sync()
+{
+    if (!m_file.isOpen()) return false;
+#if defined(Q_OS_LINUX)
+    if (::fdatasync(m_file.handle()) == 0) return true;
+#elif defined(Q_OS_UNIX)
+    if (::fsync(m_file.handle()) == 0) return true;
+#else
+    return m_file.flush();
+#endif
+#ifdef Q_OS_UNIX
+    m_errorString = QString::fromLocal8Bit(std::strerror(errno));
+    return false;
+#endif
+}
@@ -0,0 +1,77 @@
+#ifndef SEGMENTFILE_H
+#define SEGMENTFILE_H
+
+#include <QFile>
+#include <QByteArrayView>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStorageInfo>
+
+/**
+ * @brief Output file shared by all segments of a download.
+ *
+ * The file is sized to the final length up front and every segment writes at
+ * its own offset, so nothing has to be merged once the last segment lands.
+ * Its blocks are allocated at the same time where the file system allows, so
+ * a full volume shows up before the transfer and the file is not fragmented.
+ */
+class SegmentFile
+{
+public:
+    explicit SegmentFile(const QString &path);
+    ~SegmentFile();
+
+    bool open(qint64 totalSize);
+    void close();
+    bool remove();
+    bool isOpen() const { return m_file.isOpen(); }
+    // Allocates blocks for the range; keepSize leaves the file length alone.
+    // Fails only when the volume is full, otherwise the file may stay sparse.
+    bool reserve(qint64 offset, qint64 length, bool keepSize = false);
+
+    qint64 writeAt(qint64 offset, const char *data, qint64 len);
+    qint64 writeAt(qint64 offset, const QByteArray &data) { return writeAt(offset, data.constData(), data.size()); }
+    // Writes the parts back to back starting at offset, in one call where possible
+    qint64 writeAt(qint64 offset, const QList<QByteArrayView> &parts);
+    qint64 readAt(qint64 offset, char *data, qint64 len);
+    bool flush();
+    bool sync(); // Data to stable storage
+
+    // Large-file mode: written pages are pushed to disk and dropped from the
+    // page cache as the file fills, instead of piling up until close
+    struct Writeback {
+        struct Range {
+            qint64 start;
+            qint64 end; // Exclusive
+        };
+        // Disjoint; about one per segment, since each writes its range front to back
+        QList<Range> written; // Since the last round
+        QList<Range> syncing; // Sent to disk by the last round
+        qint64 pending = 0;   // Bytes in written
+        void note(qint64 offset, qint64 length);
+        bool isDue() const { return pending >= kWritebackInterval; }
+    };
+    void setDropBehind(bool enabled) { m_dropBehind = enabled; }
+    void noteWritten(qint64 offset, qint64 bytes); // From the thread that wrote them
+    static void writeBack(int handle, Writeback *ranges);
+    static constexpr qint64 kWritebackInterval = 32 * 1024 * 1024;
+
+    int handle() const { return m_file.handle(); }
+    QString fileName() const { return m_file.fileName(); }
+    QString errorString() const { return m_errorString; }
+
+    // Bytes the file really occupies on disk (less than its size while sparse)
+    static qint64 allocatedSize(const QString &path);
+    // Volume the path is (or will be, once its directories exist) on
+    static QStorageInfo volumeOf(const QString &path);
+
+private:
+    QFile m_file;
+    QMutex m_seekMutex; // Only used where positional writes are unavailable
+    QString m_errorString;
+    bool m_dropBehind = false;
+    Writeback m_writeback; // Only touched by the disk writer thread
+};
+
+#endif // SEGMENTFILE_H
@@ -0,0 +1,65 @@
+#include "speedmeter.h"
+#include <cmath>
+
+namespace {
+constexpr double kTimeConstantMs = 5000; // Of the smoothed rate
+}
+
+void SpeedMeter::clear()
+{
+    *this = SpeedMeter();
+}
+
+void SpeedMeter::rebase(qint64 bytes)
+{
+    m_lastBytes = bytes;
+    m_windowCount = 0; // Intervals across the jump say nothing about the time left
+}
+
+void SpeedMeter::addSample(qint64 bytes, qint64 msecs)
+{
+    if (msecs <= 0) return;
+    if (bytes < m_lastBytes) {
+        rebase(bytes);
+        return;
+    }
+    const qint64 delta = bytes - m_lastBytes;
+    m_lastBytes = bytes;
+    m_lastRate = delta * 1000 / msecs;
+
+    // Weight by elapsed time so a late tick does not count like a punctual one
+    const double weight = 1 - std::exp(-msecs / kTimeConstantMs);
+    m_rate = m_primed ? m_rate + weight * (m_lastRate - m_rate) : m_lastRate;
+    m_primed = true;
+
+    m_window[m_windowHead] = {msecs, delta};
+    m_windowHead = (m_windowHead + 1) % kWindowSize;
+    m_windowCount = qMin(m_windowCount + 1, kWindowSize);
+
+    m_history[m_historyHead] = m_lastRate;
+    m_historyHead = (m_historyHead + 1) % kHistorySize;
+    m_historyCount = qMin(m_historyCount + 1, kHistorySize);
+}
+
+qint64 SpeedMeter::secondsLeft(qint64 remaining) const
+{
+    if (remaining <= 0) return 0;
+    qint64 msecs = 0;
+    qint64 bytes = 0;
+    for (int i = 1; i <= m_windowCount; ++i) {
+        const Interval &interval = m_window[(m_windowHead - i + kWindowSize) % kWindowSize];
+        msecs += interval.msecs;
+        bytes += interval.bytes;
+    }
+    if (bytes <= 0) return -1;
+    return qint64(std::ceil(double(remaining) * msecs / bytes / 1000));
+}
+
+QList<qint64> SpeedMeter::history() const
+{
+    QList<qint64> rates;
+    rates.reserve(m_historyCount);
+    const int first = (m_historyHead - m_historyCount + kHistorySize) % kHistorySize;
+    for (int i = 0; i < m_historyCount; ++i) rates.append(m_history[(first + i) % kHistorySize]);
+    return rates;
+}
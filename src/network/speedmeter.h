@@ -0,0 +1,50 @@
+#ifndef SPEEDMETER_H
+#define SPEEDMETER_H
+
+#include <QList>
+#include <QtGlobal>
+#include <array>
+
+/**
+ * @brief Transfer rate of one download, fed one byte count per scheduler tick.
+ *
+ * Keeps an exponentially weighted rate for display, a short sliding window for
+ * the time left (steadier than the last tick, quicker than the average to
+ * follow a real change) and a fixed ring of past rates for graphs.
+ */
+class SpeedMeter
+{
+public:
+    static constexpr int kHistorySize = 300; // Five minutes of one-second ticks
+
+    void clear();
+    // The byte count jumped (resume, discarded data); rates and history are kept
+    void rebase(qint64 bytes);
+    // bytes: total received so far; msecs: time since the previous sample
+    void addSample(qint64 bytes, qint64 msecs);
+
+    qint64 lastRate() const { return m_lastRate; } // Over the last tick only
+    qint64 rate() const { return qint64(m_rate); }
+    qint64 secondsLeft(qint64 remaining) const;   // -1 while unknown
+    QList<qint64> history() const;                // Oldest first
+
+private:
+    static constexpr int kWindowSize = 10;
+    struct Interval {
+        qint64 msecs = 0;
+        qint64 bytes = 0;
+    };
+
+    qint64 m_lastBytes = 0;
+    qint64 m_lastRate = 0;
+    double m_rate = 0;
+    bool m_primed = false;
+    std::array<Interval, kWindowSize> m_window{};
+    int m_windowHead = 0;
+    int m_windowCount = 0;
+    std::array<qint64, kHistorySize> m_history{};
+    int m_historyHead = 0;
+    int m_historyCount = 0;
+};
+
+#endif // SPEEDMETER_H
@@ -0,0 +1,155 @@
+#include "streamsession.h"
+#include "downloaditem.h"
+#include <QDebug>
+#include <QMimeDatabase>
+
+namespace {
+constexpr qint64 kReadSize = 256 * 1024;        // File read per write to the socket
+constexpr qint64 kMaxQueued = 1024 * 1024;      // Unsent bytes before waiting for bytesWritten()
+constexpr int kPollMs = 200;                    // How often missing bytes are looked for
+constexpr qint64 kMaxWaitMs = 60000;            // Give up on bytes that do not come
+
+QByteArray headerValue(const QByteArray &request, const QByteArray &name)
+{
+    const QList<QByteArray> lines = request.split('\n');
+    for (const QByteArray &line : lines) {
+        const qsizetype colon = line.indexOf(':');
+        if (colon > 0 && line.left(colon).trimmed().toLower() == name) return line.mid(colon + 1).trimmed();
+    }
+    return QByteArray();
+}
+
+// "bytes=first-last", "bytes=first-" or "bytes=-suffix", against total
+bool parseRange(const QByteArray &value, qint64 total, qint64 *first, qint64 *last)
+{
+    if (!value.startsWith("bytes=")) return false;
+    const QByteArray spec = value.mid(6).trimmed();
+    const qsizetype dash = spec.indexOf('-');
+    if (dash < 0) return false;
+    const QByteArray from = spec.left(dash).trimmed();
+    const QByteArray to = spec.mid(dash + 1).trimmed();
+    bool ok = true;
+    if (from.isEmpty()) {
+        const qint64 suffix = to.toLongLong(&ok);
+        if (!ok || suffix <= 0) return false;
+        *first = qMax<qint64>(0, total - suffix);
+        *last = total - 1;
+        return true;
+    }
+    *first = from.toLongLong(&ok);
+    if (!ok || *first < 0 || *first >= total) return false;
+    *last = to.isEmpty() ? total - 1 : qMin(total - 1, to.toLongLong(&ok));
+    return ok && *last >= *first;
+}
+}
+
+StreamSession::StreamSession(QTcpSocket *socket, DownloadItem *item, const QByteArray &request, QObject *parent)
+    : QObject(parent), m_socket(socket), m_item(item), m_file(item->getFullFilePath())
+{
+    m_clock.start();
+    m_waitTimer.setSingleShot(true);
+    connect(&m_waitTimer, &QTimer::timeout, this, &StreamSession::pump);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &StreamSession::pump);
+    connect(m_socket, &QTcpSocket::disconnected, this, &QObject::deleteLater);
+
+    const qint64 total = item->getTotalSize();
+    if (total <= 0) {
+        respond("503 Service Unavailable", "The size of the file is not known yet", "Retry-After: 1\r\n");
+        return;
+    }
+    if (item->getState() != DownloadItem::Completed && item->getWriteMode() == DownloadItem::ChunkFiles && !item->isSingleChunk()) {
+        respond("409 Conflict", "Downloads kept in chunk files can only be played once merged");
+        return;
+    }
+    // Unbuffered: the file grows while it is read, a buffer would keep a stale end
+    if (!m_file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        respond("503 Service Unavailable", "The file is not there yet", "Retry-After: 1\r\n");
+        return;
+    }
+
+    qint64 first = 0;
+    qint64 last = total - 1;
+    const QByteArray range = headerValue(request, "range");
+    const bool partial = !range.isEmpty() && !range.contains(','); // Several ranges: the whole file instead
+    if (partial && !parseRange(range, total, &first, &last)) {
+        respond("416 Range Not Satisfiable", QByteArray(), "Content-Range: bytes */" + QByteArray::number(total) + "\r\n");
+        return;
+    }
+    m_position = first;
+    m_last = last;
+
+    QByteArray response = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+    response += "Content-Type: " + QMimeDatabase().mimeTypeForFile(item->getFileName(), QMimeDatabase::MatchExtension).name().toLatin1() + "\r\n";
+    response += "Content-Length: " + QByteArray::number(last - first + 1) + "\r\n";
+    if (partial) response += "Content-Range: bytes " + QByteArray::number(first) + "-" + QByteArray::number(last) + "/" + QByteArray::number(total) + "\r\n";
+    response += "Accept-Ranges: bytes\r\nConnection: close\r\n\r\n";
+    m_socket->write(response);
+    if (request.startsWith("HEAD ")) {
+        finish();
+        return;
+    }
+    item->setStreamPosition(first);
+    pump();
+}
+
+/**
+ * @brief Sends what is in the file from the current position while the socket
+ * keeps up, then waits: for bytesWritten() when the socket is full, or polls
+ * when the next bytes have not been downloaded yet.
+ */
+void StreamSession::pump()
+{
+    if (!m_socket || m_socket->state() != QAbstractSocket::ConnectedState || !m_item) {
+        finish();
+        return;
+    }
+    while (m_position <= m_last && m_socket->bytesToWrite() < kMaxQueued) {
+        const qint64 available = qMin(m_item->availableAt(m_position), m_last - m_position + 1);
+        if (available <= 0) {
+            const DownloadItem::State state = m_item->getState();
+            if (state == DownloadItem::Failed || state == DownloadItem::Stopped) {
+                finish(); // Nothing more will come
+                return;
+            }
+            if (m_waitingSince < 0) {
+                m_waitingSince = m_clock.elapsed();
+                m_item->setStreamPosition(m_position); // The player waits here
+            } else if (m_clock.elapsed() - m_waitingSince > kMaxWaitMs) {
+                qWarning() << "Stream of" << m_item->getFileName() << "got nothing at" << m_position << "for" << kMaxWaitMs / 1000 << "s";
+                finish();
+                return;
+            }
+            m_waitTimer.start(kPollMs);
+            return;
+        }
+        m_waitingSince = -1;
+
+        QByteArray data;
+        if (m_file.seek(m_position)) data = m_file.read(qMin(available, kReadSize));
+        if (data.isEmpty()) {
+            qWarning() << "Stream of" << m_item->getFileName() << "cannot read at" << m_position << m_file.errorString();
+            finish();
+            return;
+        }
+        m_socket->write(data);
+        m_position += data.size();
+    }
+    if (m_position > m_last && m_socket->bytesToWrite() == 0) finish(); // Otherwise bytesWritten() comes back
+}
+
+void StreamSession::respond(const QByteArray &status, const QByteArray &body, const QByteArray &extraHeaders)
+{
+    m_socket->write("HTTP/1.1 " + status + "\r\nContent-Type: text/plain\r\n"
+                    + "Content-Length: " + QByteArray::number(body.size()) + "\r\n" + extraHeaders + "Connection: close\r\n\r\n" + body);
+    finish();
+}
+
+void StreamSession::finish()
+{
+    m_waitTimer.stop();
+    if (m_socket) {
+        disconnect(m_socket, nullptr, this, nullptr);
+        m_socket->disconnectFromHost(); // After what is still queued
+    }
+    deleteLater();
+}
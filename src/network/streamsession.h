@@ -0,0 +1,45 @@
+#ifndef STREAMSESSION_H
+#define STREAMSESSION_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QPointer>
+#include <QTcpSocket>
+#include <QTimer>
+
+class DownloadItem;
+
+/**
+ * @brief Serves one HTTP request for a download that may still be running.
+ *
+ * Answers GET and HEAD, with or without a single byte Range, from the target
+ * file. Bytes that have not landed yet are waited for rather than refused, and
+ * the item is told where the player reads so that range is fetched first.
+ * The connection is closed after the response.
+ */
+class StreamSession : public QObject
+{
+    Q_OBJECT
+public:
+    // request: the raw request as read from the socket, headers included
+    StreamSession(QTcpSocket *socket, DownloadItem *item, const QByteArray &request, QObject *parent = nullptr);
+
+private slots:
+    void pump();
+
+private:
+    void respond(const QByteArray &status, const QByteArray &body = QByteArray(), const QByteArray &extraHeaders = QByteArray());
+    void finish();
+
+    QPointer<QTcpSocket> m_socket;
+    QPointer<DownloadItem> m_item;
+    QFile m_file;
+    QTimer m_waitTimer;   // Polls for data while the player waits
+    qint64 m_position = 0; // Next byte to send
+    qint64 m_last = -1;    // Last byte to send, inclusive
+    qint64 m_waitingSince = -1; // On m_clock, while nothing is available
+    QElapsedTimer m_clock;
+};
+
+#endif // STREAMSESSION_H